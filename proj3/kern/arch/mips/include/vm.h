@@ -128,11 +128,18 @@ paddr_t ram_getfirstfree(void);
  * We'll take up to 16 invalidations before just flushing the whole TLB.
  */
 
+struct addrspace;
+struct semaphore;
+
+/*
+ * Invalidate the mapping of page TS_VADDR in address space TS_AS, then
+ * V() TS_DONE so the sender knows the other cpu can no longer reach
+ * the old frame.
+ */
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	struct addrspace *ts_as;
+	vaddr_t ts_vaddr;
+	struct semaphore *ts_done;
 };
 
 #define TLBSHOOTDOWN_MAX 16
@@ -38,6 +38,8 @@
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <uio.h>
+#include <vnode.h>
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -384,6 +386,72 @@ as_prepare_load(struct addrspace *as)
 	return 0;
 }
 
+/*
+ * dumbvm has no demand paging, so read the file data in right away.
+ * as_prepare_load has already given the regions their memory.
+ */
+int
+as_define_file(struct addrspace *as, vaddr_t vaddr, struct vnode *v,
+	       off_t offset, size_t filesize)
+{
+	struct iovec iov;
+	struct uio u;
+	int result;
+
+	iov.iov_ubase = (userptr_t)vaddr;
+	iov.iov_len = filesize;
+	u.uio_iov = &iov;
+	u.uio_iovcnt = 1;
+	u.uio_resid = filesize;
+	u.uio_offset = offset;
+	u.uio_segflg = UIO_USERSPACE;
+	u.uio_rw = UIO_READ;
+	u.uio_space = as;
+
+	result = VOP_READ(v, &u);
+	if (result) {
+		return result;
+	}
+	if (u.uio_resid != 0) {
+		return ENOEXEC;
+	}
+	return 0;
+}
+
+/*
+ * dumbvm's regions are fixed once loaded, so there is no heap, and
+ * nowhere to map files.
+ */
+int
+as_mmap(struct addrspace *as, struct vnode *v, size_t len, int prot,
+	off_t offset, vaddr_t *addr)
+{
+	(void)as;
+	(void)v;
+	(void)len;
+	(void)prot;
+	(void)offset;
+	(void)addr;
+	return ENOSYS;
+}
+
+int
+as_munmap(struct addrspace *as, vaddr_t addr)
+{
+	(void)as;
+	(void)addr;
+	return ENOSYS;
+}
+
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
+{
+	(void)as;
+	(void)amount;
+	(void)oldbreak;
+	return ENOSYS;
+}
+
 int
 as_complete_load(struct addrspace *as)
 {
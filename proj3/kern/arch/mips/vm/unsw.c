@@ -27,11 +27,17 @@
  * SUCH DAMAGE.
  */
 
+
 #include <types.h>
 #include <lib.h>
 #include <vm.h>
 #include <mainbus.h>
 #include <spinlock.h>
+#include <spl.h>
+#include <current.h>
+#include <cpu.h>
+#include <platform/maxcpus.h>
+#include <reclaim.h>
 
 vaddr_t firstfree;   /* first free virtual address; set by start.S */
 
@@ -39,10 +45,36 @@ static paddr_t firstpaddr;  /* address of first free physical page */
 static paddr_t lastpaddr;   /* one past end of last free physical page */
 
 
+/*
+ * The frame table is managed as a binary buddy allocator. Every free
+ * frame belongs to exactly one free block of 2^order frames that is
+ * aligned on a 2^order frame boundary. The first frame of each free
+ * block (its "head") sits on the free list for that order.
+ *
+ * Allocating a single frame pops the order 0 list, or splits the
+ * smallest larger block. A multiframe allocation splits the smallest
+ * block that fits and hands the unused tail straight back. Freeing
+ * merges a block with its buddy for as long as the buddy is free too.
+ */
 
 typedef struct ft_entry {
         unsigned allocated:1; /* the corresponding frame is allocated */
-        unsigned not_last:1; /* the frame is part of a multiframe allocation */
+        unsigned free_head:1; /* the frame is the head of a free block */
+        unsigned cached:1;    /* the frame is sitting in a frame magazine */
+        unsigned order:5;     /* order of the free block headed here */
+        unsigned npages:18;   /* length of the allocation headed here */
+        uint32_t refcount;    /* page tables sharing an allocated frame */
+        uint8_t referenced;   /* in a TLB since the clock hand passed */
+        union {
+                struct {        /* free block heads: free list links */
+                        uint32_t next;
+                        uint32_t prev;
+                } fl;
+                struct {        /* allocated user frames: reverse mapping */
+                        struct addrspace *owner;
+                        vaddr_t vaddr;
+                } map;
+        } u;
 } ft_entry_t;
 
 
@@ -54,6 +86,20 @@ static uint32_t last_frame;
 #define TRUE 1
 #define FALSE 0
 
+#define FT_ORDERS 18    /* 2^17 frames covers the 512M limit below */
+#define NO_FRAME 0      /* frame 0 holds the exception vectors, never free */
+
+static uint32_t free_lists[FT_ORDERS];  /* head of each free list */
+static uint32_t free_blocks[FT_ORDERS]; /* blocks on each free list */
+static uint32_t free_orders;    /* bit n set if free_lists[n] is nonempty */
+static uint32_t nfree;          /* frames on all the free lists */
+
+/* Allocator statistics, reported by frame_printstats() */
+static uint32_t ft_allocs;
+static uint32_t ft_frees;
+static uint32_t ft_failures;
+static uint32_t ft_runs;                /* frame_alloc_run successes */
+static uint32_t ft_run_failures;        /* ...and failures */
 
 /* frame_table protected by spinlock (interrupt disabling on
  * uniprocessor) as this implementation does not block.
@@ -61,6 +107,52 @@ static uint32_t last_frame;
 
 static struct spinlock frame_table_spinlock = SPINLOCK_INITIALIZER;
 
+/*
+ * Per-CPU frame magazines. Each CPU keeps a small stack of free frames
+ * that single frame allocations and frees use without touching the
+ * frame_table_spinlock. An empty magazine is refilled, and a full one
+ * drained, FRAME_MAG_BATCH frames at a time under one acquisition of
+ * the global lock.
+ *
+ * A magazine is only ever touched by its own CPU, with interrupts off
+ * so the thread using it cannot be preempted or migrate. Frames in a
+ * magazine are marked allocated (and cached) in the frame table, so
+ * the buddy allocator leaves them alone.
+ */
+
+#define FRAME_MAG_SIZE  16      /* frames each magazine can hold */
+#define FRAME_MAG_BATCH 8       /* frames moved per refill or drain */
+
+struct frame_mag {
+        uint32_t fm_count;                      /* frames in fm_frames */
+        uint32_t fm_frames[FRAME_MAG_SIZE];     /* LIFO stack of frames */
+        uint32_t fm_allocs;     /* frames handed out from the magazine */
+        uint32_t fm_frees;      /* frames freed into the magazine */
+        uint32_t fm_hits;       /* allocations served without a refill */
+        uint32_t fm_refills;    /* batches taken from the frame table */
+        uint32_t fm_drains;     /* batches returned to the frame table */
+};
+
+static struct frame_mag frame_mags[MAXCPUS];
+
+static void release_range(uint32_t i, uint32_t npages);
+
+/*
+ * Frames sitting in the magazines, which are free as far as anyone
+ * outside the frame allocator is concerned. Read without locking, so
+ * only a snapshot.
+ */
+static unsigned frame_mag_nframes(void)
+{
+        unsigned n, k;
+
+        n = 0;
+        for (k = 0; k < MAXCPUS; k++) {
+                n += frame_mags[k].fm_count;
+        }
+        return n;
+}
+
 /*
  * Called very early in system boot to figure out how much physical
  * RAM is available.
@@ -129,20 +221,32 @@ ram_bootstrap(void)
         for (i = 0; i < (firstpaddr >> PAGE_BITS); i++) {
                 /* Mark as allocated as individual pages */
                 frame_table[i].allocated = TRUE;
-                frame_table[i].not_last = FALSE;
+                frame_table[i].free_head = FALSE;
+                frame_table[i].cached = FALSE;
+                frame_table[i].npages = 1;
+                frame_table[i].refcount = 1;
+                frame_table[i].u.map.owner = NULL;
         }                                            
         
         /* 
-         * The second range of frames are free
+         * The second range of frames are free, and go onto the
+         * free lists as the largest aligned blocks that fit.
          */
         
         first_frame = firstpaddr >> PAGE_BITS;
-        
-        for (i = first_frame; i < (lastpaddr >> PAGE_BITS); i++) {
-                frame_table[i].allocated = FALSE;
+
+        for (i = 0; i < FT_ORDERS; i++) {
+                free_lists[i] = NO_FRAME;
+                free_blocks[i] = 0;
         }
+        free_orders = 0;
+        nfree = 0;
 
-        
+        for (i = first_frame; i < last_frame; i++) {
+                frame_table[i].free_head = FALSE;
+                frame_table[i].cached = FALSE;
+        }
+        release_range(first_frame, last_frame - first_frame);
 }
 
 /*
@@ -189,90 +293,371 @@ ram_getfirstfree(void)
 }
 
 /*
- * This is a relatively inefficient first-fit allocator. Single pages
- * always fit. Multiframe allocations can suffer from external
- * fragmentation. It is intended to be easy to understand and robust,
- * not efficient.
+ * Free list manipulation. All of these are called with the
+ * frame_table_spinlock held.
  */
 
+static void fl_insert(uint32_t i, unsigned order)
+{
+        uint32_t head = free_lists[order];
+
+        frame_table[i].allocated = FALSE;
+        frame_table[i].free_head = TRUE;
+        frame_table[i].order = order;
+        frame_table[i].u.fl.prev = NO_FRAME;
+        frame_table[i].u.fl.next = head;
+        if (head != NO_FRAME) {
+                frame_table[head].u.fl.prev = i;
+        }
+        free_lists[order] = i;
+        free_blocks[order]++;
+        free_orders |= 1 << order;
+}
 
-static paddr_t alloc_one_frame(unsigned int npages)
+static void fl_remove(uint32_t i)
 {
-        unsigned int i;
+        unsigned order = frame_table[i].order;
+        uint32_t next = frame_table[i].u.fl.next;
+        uint32_t prev = frame_table[i].u.fl.prev;
 
-        /* 
-         * Just scan from the start of the frame_table array for an
-         * unallocated block
-         */
-        
-        KASSERT(npages == 1);
+        KASSERT(frame_table[i].free_head == TRUE);
 
-        spinlock_acquire(&frame_table_spinlock);
-        for (i =  first_frame; i < last_frame; i++) {
-                if (frame_table[i].allocated == FALSE) {
-                        frame_table[i].allocated = TRUE;
-                        frame_table[i].not_last = FALSE;
+        if (prev != NO_FRAME) {
+                frame_table[prev].u.fl.next = next;
+        }
+        else {
+                free_lists[order] = next;
+        }
+        if (next != NO_FRAME) {
+                frame_table[next].u.fl.prev = prev;
+        }
+        frame_table[i].free_head = FALSE;
 
-                        spinlock_release(&frame_table_spinlock);
+        free_blocks[order]--;
+        if (free_lists[order] == NO_FRAME) {
+                free_orders &= ~(1 << order);
+        }
+}
+
+/*
+ * Put the free block of 2^order frames at i back on the free lists,
+ * merging it with its buddy for as long as the buddy is also a whole
+ * free block of the same order.
+ */
+static void release_block(uint32_t i, unsigned order)
+{
+        uint32_t buddy;
 
-                        return (paddr_t) (i << PAGE_BITS);
+        while (order + 1 < FT_ORDERS) {
+                buddy = i ^ (1 << order);
+                if (buddy < first_frame || buddy + (1 << order) > last_frame) {
+                        break;
+                }
+                if (frame_table[buddy].free_head == FALSE ||
+                    frame_table[buddy].order != order) {
+                        break;
                 }
+                fl_remove(buddy);
+                i = i & buddy;  /* the merged block starts at the lower one */
+                order++;
         }
-        
-        /* Did not find an unallocated frame :-( */
+        fl_insert(i, order);
+}
 
-        spinlock_release(&frame_table_spinlock);
-        return (paddr_t) 0;
+/*
+ * Free an arbitrary run of frames by splitting it into the largest
+ * naturally aligned blocks it contains.
+ */
+static void release_range(uint32_t i, uint32_t npages)
+{
+        uint32_t j;
+        unsigned order;
+
+        for (j = i; j < i + npages; j++) {
+                frame_table[j].allocated = FALSE;
+                frame_table[j].npages = 0;
+        }
+        nfree += npages;
+
+        while (npages > 0) {
+                order = 0;
+                while (order + 1 < FT_ORDERS &&
+                       (i & ((1 << (order + 1)) - 1)) == 0 &&
+                       (1U << (order + 1)) <= npages) {
+                        order++;
+                }
+                release_block(i, order);
+                i += 1 << order;
+                npages -= 1 << order;
+        }
 }
 
-static paddr_t alloc_multiple_frames(unsigned int npages)
+/*
+ * Take a free block of at least 2^order frames off the free lists,
+ * splitting a larger block if need be. The halves split off go back
+ * on the lower order free lists. Returns NO_FRAME if nothing fits.
+ */
+static uint32_t grab_block(unsigned order)
 {
-        unsigned int i,j;
+        uint32_t mask, i;
+        unsigned k;
 
+        mask = free_orders & ~((1 << order) - 1);
+        if (mask == 0) {
+                return NO_FRAME;
+        }
 
-        /* scan from 'i' for the number of needed free frames. If an
-         * allocated frame is encountered, restart the scan from after
-         * that point.
-         */
-        
+        for (k = order; (mask & (1 << k)) == 0; k++);
+
+        i = free_lists[k];
+        fl_remove(i);
+
+        while (k > order) {
+                k--;
+                fl_insert(i + (1 << k), k);
+        }
+
+        nfree -= 1 << order;
+        return i;
+}
+
+/*
+ * Mark a run of frames just taken off the free lists as one allocation.
+ */
+static void mark_allocated(uint32_t i, uint32_t npages)
+{
+        uint32_t j;
+
+        for (j = i; j < i + npages; j++) {
+                frame_table[j].allocated = TRUE;
+                frame_table[j].npages = 0;
+        }
+        frame_table[i].npages = npages;
+        frame_table[i].refcount = 1;
+        frame_table[i].referenced = FALSE;
+        frame_table[i].u.map.owner = NULL;
+}
+
+/*
+ * Move up to FRAME_MAG_BATCH free frames from the frame table into an
+ * empty magazine. Called with interrupts off.
+ */
+static void frame_mag_refill(struct frame_mag *mag)
+{
+        uint32_t i;
 
         spinlock_acquire(&frame_table_spinlock);
+        while (mag->fm_count < FRAME_MAG_BATCH) {
+                i = grab_block(0);
+                if (i == NO_FRAME) {
+                        break;
+                }
+                mark_allocated(i, 1);
+                frame_table[i].cached = TRUE;
+                mag->fm_frames[mag->fm_count++] = i;
+        }
+        mag->fm_refills++;
+        spinlock_release(&frame_table_spinlock);
+}
+
+/*
+ * Return the NFRAMES coldest frames in a magazine (the bottom of the
+ * stack) to the frame table. Called with interrupts off.
+ */
+static void frame_mag_drain(struct frame_mag *mag, uint32_t nframes)
+{
+        uint32_t i, j;
+
+        KASSERT(nframes <= mag->fm_count);
+
+        spinlock_acquire(&frame_table_spinlock);
+        for (j = 0; j < nframes; j++) {
+                i = mag->fm_frames[j];
+                frame_table[i].cached = FALSE;
+                release_range(i, 1);
+        }
+        mag->fm_drains++;
+        spinlock_release(&frame_table_spinlock);
+
+        for (j = nframes; j < mag->fm_count; j++) {
+                mag->fm_frames[j - nframes] = mag->fm_frames[j];
+        }
+        mag->fm_count -= nframes;
+}
+
+/*
+ * Hand back every frame cached by the current CPU, so that a failing
+ * multiframe allocation gets a chance to coalesce them.
+ */
+static void frame_mag_flush(void)
+{
+        struct frame_mag *mag;
+        int spl;
+
+        if (!CURCPU_EXISTS()) {
+                return;
+        }
+
+        spl = splhigh();
+        mag = &frame_mags[curcpu->c_number];
+        if (mag->fm_count > 0) {
+                frame_mag_drain(mag, mag->fm_count);
+        }
+        splx(spl);
+}
+
+static paddr_t alloc_one_frame(unsigned int npages)
+{
+        struct frame_mag *mag;
+        uint32_t i;
+        bool refilled;
+        int spl;
+
+        KASSERT(npages == 1);
 
-        i = first_frame; j = 0;
+        /*
+         * Common case: take a frame from this CPU's magazine. Before
+         * curcpu exists (early boot) go straight to the frame table.
+         */
+        if (CURCPU_EXISTS()) {
+                spl = splhigh();
+                mag = &frame_mags[curcpu->c_number];
+
+                refilled = false;
+                if (mag->fm_count == 0) {
+                        frame_mag_refill(mag);
+                        refilled = true;
+                }
 
-        while (i < (last_frame - npages) && j < npages) {
-                if (frame_table[i+j].allocated == TRUE) {
-                        i = i + j + 1; /* continue scan after allocated frame */
-                        j = 0;         /* restart the count */
+                if (mag->fm_count == 0) {
+                        /* The frame table is empty too :-( */
+                        splx(spl);
+                        spinlock_acquire(&frame_table_spinlock);
+                        ft_failures++;
+                        spinlock_release(&frame_table_spinlock);
+                        return (paddr_t) 0;
                 }
-                else {
-                        j = j + 1; /* increment count of free frames */
+
+                i = mag->fm_frames[--mag->fm_count];
+                frame_table[i].cached = FALSE;
+                frame_table[i].refcount = 1;
+                frame_table[i].referenced = FALSE;
+                frame_table[i].u.map.owner = NULL;
+                mag->fm_allocs++;
+                if (!refilled) {
+                        mag->fm_hits++;
                 }
+                splx(spl);
+
+                return (paddr_t) (i << PAGE_BITS);
         }
 
-        if  (j == npages) { /* we exited as we found the number of frames required. */
-                for (j = i; j < i + npages - 1; j++) {
-                        frame_table[j].allocated = TRUE; /* mark frame allocated */
-                        frame_table[j].not_last = TRUE;  /* as a contiguous block */
-                }
-                frame_table[j].allocated = TRUE;
-                frame_table[j].not_last = FALSE;
+        spinlock_acquire(&frame_table_spinlock);
 
+        i = grab_block(0);
+        if (i == NO_FRAME) {
+                /* Did not find an unallocated frame :-( */
+                ft_failures++;
                 spinlock_release(&frame_table_spinlock);
+                return (paddr_t) 0;
+        }
+        mark_allocated(i, 1);
+        ft_allocs++;
+
+        spinlock_release(&frame_table_spinlock);
+
+        return (paddr_t) (i << PAGE_BITS);
+}
+
+static paddr_t alloc_multiple_frames(unsigned int npages)
+{
+        uint32_t i;
+        unsigned order;
+
+        /* Round up to the smallest block that holds npages */
+        for (order = 0; (1U << order) < npages; order++);
+        if (order >= FT_ORDERS) {
+                return (paddr_t) 0;
+        }
+
+        spinlock_acquire(&frame_table_spinlock);
+
+        i = grab_block(order);
+        if (i == NO_FRAME) {
+                /*
+                 * Frames cached in this CPU's magazine may be what
+                 * stops a big enough block from forming. Flush them
+                 * and try once more.
+                 */
+                spinlock_release(&frame_table_spinlock);
+                frame_mag_flush();
+                spinlock_acquire(&frame_table_spinlock);
+                i = grab_block(order);
+        }
+        if (i == NO_FRAME) {
+                /* Did not find an unallocated contiguous range of frames :-( */
+                ft_failures++;
+                spinlock_release(&frame_table_spinlock);
+                return (paddr_t) 0;
+        }
+
+        /* Give back the part of the block we don't need */
+        if ((1U << order) > npages) {
+                release_range(i + npages, (1 << order) - npages);
+        }
+        mark_allocated(i, npages);
+        ft_allocs++;
+
+        spinlock_release(&frame_table_spinlock);
                 
-                return (paddr_t) (i << PAGE_BITS);
+        return (paddr_t) (i << PAGE_BITS);
+}
+
+/*
+ * Allocate a run of NPAGES (a power of two) physically contiguous
+ * frames for user pages. Each frame is marked as an allocation of its
+ * own, so that once mapped they can be shared, evicted and freed one
+ * at a time like any other user frame. The run is aligned to its size.
+ *
+ * A run is only ever an optimisation, so this doesn't reclaim or
+ * flush the magazines to find one; it returns 0 and the caller makes
+ * do with single frames.
+ */
+paddr_t
+frame_alloc_run(unsigned npages)
+{
+        uint32_t i, j;
+        unsigned order;
+
+        for (order = 0; (1U << order) < npages; order++);
+        KASSERT((1U << order) == npages);
+        if (order >= FT_ORDERS) {
+                return (paddr_t) 0;
         }
-        
-        /* Did not find an unallocated contiguous range of frames :-( */
 
+        spinlock_acquire(&frame_table_spinlock);
+        i = grab_block(order);
+        if (i == NO_FRAME) {
+                ft_run_failures++;
+                spinlock_release(&frame_table_spinlock);
+                return (paddr_t) 0;
+        }
+        for (j = i; j < i + npages; j++) {
+                mark_allocated(j, 1);
+        }
+        ft_allocs += npages;
+        ft_runs++;
         spinlock_release(&frame_table_spinlock);
-        return (paddr_t) 0;
+
+        return (paddr_t) (i << PAGE_BITS);
 }
 
 static void free_frames(vaddr_t vaddr)
 {
+        struct frame_mag *mag;
         paddr_t paddr;
         uint32_t i;
+        int spl;
 
         KASSERT(vaddr != (vaddr_t) NULL);
 
@@ -280,32 +665,81 @@ static void free_frames(vaddr_t vaddr)
 
         i = paddr >> PAGE_BITS;
 
+        KASSERT(i >= first_frame && i < last_frame);
+
+        /*
+         * Single frames go back into this CPU's magazine, draining
+         * the coldest half of it to the frame table if it is full.
+         * The entry of an allocated frame is only touched by its
+         * owner, so the checks don't need the lock.
+         */
+        if (CURCPU_EXISTS() && frame_table[i].npages == 1) {
+                if (frame_table[i].allocated == FALSE ||
+                    frame_table[i].cached == TRUE) {
+                        panic("Double free error!!");
+                }
+
+                spl = splhigh();
+                mag = &frame_mags[curcpu->c_number];
+                if (mag->fm_count == FRAME_MAG_SIZE) {
+                        frame_mag_drain(mag, FRAME_MAG_BATCH);
+                }
+                frame_table[i].cached = TRUE;
+                mag->fm_frames[mag->fm_count++] = i;
+                mag->fm_frees++;
+                splx(spl);
+                return;
+        }
+
         spinlock_acquire(&frame_table_spinlock);
 
         if (frame_table[i].allocated == FALSE) { /* check for double free error */
                 panic("Double free error!!");
         }
-        
-        while (frame_table[i].allocated == TRUE) { /* otherwise mark block free */
-                frame_table[i].allocated = FALSE;
-                if (frame_table[i].not_last == TRUE) {
-                        i++;
-                }
+        if (frame_table[i].npages == 0) {
+                panic("free_kpages: 0x%x is not the start of an allocation",
+                      vaddr);
         }
+
+        release_range(i, frame_table[i].npages);
+        ft_frees++;
+
         spinlock_release(&frame_table_spinlock);
 }
         
+/* Times a failed allocation reclaims and retries before giving up */
+#define RECLAIM_TRIES   4
+
 /* Allocate/free some kernel-space virtual pages */
 vaddr_t
 alloc_kpages(unsigned npages)
 {
         paddr_t paddr;
-        if (npages > 1 ) {
-                paddr = alloc_multiple_frames(npages);
-        }
-        else {
-                paddr = alloc_one_frame(npages);
+        unsigned tries;
+
+        /*
+         * If we are out of frames, reclaim some and try again. A
+         * multiframe allocation may need a few goes before the frames
+         * given back coalesce into a big enough block.
+         */
+        for (tries = 0; ; tries++) {
+                if (npages > 1 ) {
+                        paddr = alloc_multiple_frames(npages);
+                }
+                else {
+                        paddr = alloc_one_frame(npages);
+                }
+                if (paddr != 0 || tries == RECLAIM_TRIES ||
+                    reclaim_sync(npages) == 0) {
+                        break;
+                }
         }
+
+        /*
+         * An unlocked peek at the free count, magazines included as
+         * in frame_nfree, is plenty for deciding this.
+         */
+        reclaim_poke(nfree + frame_mag_nframes());
         
 	if (paddr == 0) {
 		return 0;
@@ -319,3 +753,264 @@ free_kpages(vaddr_t addr)
         free_frames(addr);
 }
 
+/*
+ * Reference counting for user frames shared between page tables
+ * (copy-on-write after fork). A frame starts with one reference when
+ * allocated; frame_decref() frees it when the last one is dropped.
+ */
+void
+frame_incref(paddr_t paddr)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+
+        KASSERT(i >= first_frame && i < last_frame);
+
+        spinlock_acquire(&frame_table_spinlock);
+        KASSERT(frame_table[i].allocated == TRUE);
+        KASSERT(frame_table[i].refcount > 0);
+        frame_table[i].refcount++;
+        /* A shared frame has no single owner to evict it from */
+        frame_table[i].u.map.owner = NULL;
+        spinlock_release(&frame_table_spinlock);
+}
+
+void
+frame_decref(paddr_t paddr)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+        uint32_t refs;
+
+        KASSERT(i >= first_frame && i < last_frame);
+
+        spinlock_acquire(&frame_table_spinlock);
+        KASSERT(frame_table[i].allocated == TRUE);
+        KASSERT(frame_table[i].refcount > 0);
+        refs = --frame_table[i].refcount;
+        spinlock_release(&frame_table_spinlock);
+
+        if (refs == 0) {
+                free_frames(PADDR_TO_KVADDR(paddr & PAGE_FRAME));
+        }
+}
+
+/*
+ * Drop one reference on each of NFRAMES user frames, taking the frame
+ * table lock once for the lot. Frames that are no longer referenced
+ * go straight back on the free lists (not through the magazines) so
+ * that a dying address space's memory coalesces.
+ */
+void
+frame_decref_batch(const paddr_t *frames, unsigned nframes)
+{
+        unsigned k;
+        uint32_t i;
+
+        spinlock_acquire(&frame_table_spinlock);
+        for (k = 0; k < nframes; k++) {
+                i = frames[k] >> PAGE_BITS;
+
+                KASSERT(i >= first_frame && i < last_frame);
+                KASSERT(frame_table[i].allocated == TRUE);
+                KASSERT(frame_table[i].cached == FALSE);
+                KASSERT(frame_table[i].refcount > 0);
+
+                if (--frame_table[i].refcount == 0) {
+                        release_range(i, frame_table[i].npages);
+                        ft_frees++;
+                }
+        }
+        spinlock_release(&frame_table_spinlock);
+}
+
+unsigned
+frame_getref(paddr_t paddr)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+        unsigned refs;
+
+        KASSERT(i >= first_frame && i < last_frame);
+
+        spinlock_acquire(&frame_table_spinlock);
+        refs = frame_table[i].refcount;
+        spinlock_release(&frame_table_spinlock);
+
+        return refs;
+}
+
+/*
+ * Record which address space and page an unshared user frame is
+ * mapped at, making it a candidate for eviction to swap. Frames
+ * without an owner (kernel memory, and user frames that are shared or
+ * still being filled in) are never evicted.
+ */
+void
+frame_set_owner(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+
+        KASSERT(i >= first_frame && i < last_frame);
+
+        spinlock_acquire(&frame_table_spinlock);
+        KASSERT(frame_table[i].allocated == TRUE);
+        KASSERT(frame_table[i].npages == 1);
+        frame_table[i].u.map.owner = as;
+        frame_table[i].u.map.vaddr = vaddr & PAGE_FRAME;
+        frame_table[i].referenced = TRUE;
+        spinlock_release(&frame_table_spinlock);
+}
+
+/*
+ * Note that a frame was just loaded into a TLB. This is a single byte
+ * store, so it is done without the lock.
+ */
+void
+frame_reference(paddr_t paddr)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+
+        KASSERT(i >= first_frame && i < last_frame);
+        frame_table[i].referenced = TRUE;
+}
+
+/*
+ * Clock (second chance) page replacement. The hand sweeps the frame
+ * table looking at evictable user frames; one that has been loaded
+ * into a TLB since the hand last passed gets its referenced flag
+ * cleared and is skipped, the first one that hasn't is the victim.
+ * TLB refills are the only reference information we get, so this
+ * approximates "used recently" by "missed in the TLB recently".
+ *
+ * Returns the victim frame along with the address space and page it
+ * is mapped at, or 0 if there is nothing that can be evicted.
+ */
+static uint32_t clock_hand;
+
+paddr_t
+frame_pick_victim(struct addrspace **as, vaddr_t *vaddr)
+{
+        ft_entry_t *e;
+        uint32_t n, nframes;
+
+        nframes = last_frame - first_frame;
+
+        spinlock_acquire(&frame_table_spinlock);
+        if (clock_hand < first_frame || clock_hand >= last_frame) {
+                clock_hand = first_frame;
+        }
+
+        /* Two sweeps: the first may only be clearing referenced flags */
+        for (n = 0; n < 2 * nframes; n++) {
+                e = &frame_table[clock_hand];
+                if (++clock_hand == last_frame) {
+                        clock_hand = first_frame;
+                }
+
+                if (e->allocated == FALSE || e->cached == TRUE ||
+                    e->npages != 1 || e->refcount != 1 ||
+                    e->u.map.owner == NULL) {
+                        continue;
+                }
+                if (e->referenced) {
+                        e->referenced = FALSE;
+                        continue;
+                }
+
+                *as = e->u.map.owner;
+                *vaddr = e->u.map.vaddr;
+                spinlock_release(&frame_table_spinlock);
+                return (paddr_t) ((e - frame_table) << PAGE_BITS);
+        }
+        spinlock_release(&frame_table_spinlock);
+
+        return (paddr_t) 0;
+}
+
+/*
+ * Number of free frames, including those cached in the magazines.
+ */
+unsigned
+frame_nfree(void)
+{
+        unsigned free;
+
+        spinlock_acquire(&frame_table_spinlock);
+        free = nfree;
+        spinlock_release(&frame_table_spinlock);
+
+        return free + frame_mag_nframes();
+}
+
+/*
+ * Print the state of the frame allocator: free blocks of each order,
+ * and how badly fragmented the free memory is. External fragmentation
+ * is reported as the percentage of free frames that are not in the
+ * largest free block.
+ */
+void
+frame_printstats(void)
+{
+        uint32_t blocks[FT_ORDERS];
+        uint32_t free, orders, allocs, frees, failures, largest;
+        uint32_t cached, runs, runfails;
+        struct frame_mag *mag;
+        unsigned k;
+
+        cached = frame_mag_nframes();
+
+        spinlock_acquire(&frame_table_spinlock);
+        for (k = 0; k < FT_ORDERS; k++) {
+                blocks[k] = free_blocks[k];
+        }
+        free = nfree;
+        orders = free_orders;
+        allocs = ft_allocs;
+        frees = ft_frees;
+        failures = ft_failures;
+        runs = ft_runs;
+        runfails = ft_run_failures;
+        spinlock_release(&frame_table_spinlock);
+
+        /* Most single frames come and go through the magazines */
+        for (k = 0; k < MAXCPUS; k++) {
+                allocs += frame_mags[k].fm_allocs;
+                frees += frame_mags[k].fm_frees;
+        }
+
+        largest = 0;
+        for (k = 0; k < FT_ORDERS; k++) {
+                if (orders & (1 << k)) {
+                        largest = 1 << k;
+                }
+        }
+
+        kprintf("Frame table: %u frames managed, %u free, "
+                "%u more cached per-CPU\n",
+                last_frame - first_frame, free, cached);
+        kprintf("Free blocks by order:\n");
+        for (k = 0; k < FT_ORDERS; k++) {
+                if (blocks[k] > 0) {
+                        kprintf("    order %2u (%6u pages): %u\n",
+                                k, 1 << k, blocks[k]);
+                }
+        }
+        kprintf("Largest free block: %u pages\n", largest);
+        kprintf("External fragmentation: %u%%\n",
+                free == 0 ? 0 : 100 - (largest * 100) / free);
+        kprintf("%u allocations, %u frees, %u failed\n",
+                allocs, frees, failures);
+        kprintf("%u contiguous runs for large pages, %u not available\n",
+                runs, runfails);
+
+        kprintf("Per-CPU frame magazines (%u frames, batch %u):\n",
+                FRAME_MAG_SIZE, FRAME_MAG_BATCH);
+        for (k = 0; k < MAXCPUS; k++) {
+                mag = &frame_mags[k];
+                if (mag->fm_allocs + mag->fm_frees == 0) {
+                        continue;
+                }
+                kprintf("    cpu%u: %u cached, %u allocs (%u hits), "
+                        "%u frees, %u refills, %u drains\n", k,
+                        mag->fm_count, mag->fm_allocs, mag->fm_hits,
+                        mag->fm_frees, mag->fm_refills, mag->fm_drains);
+        }
+}
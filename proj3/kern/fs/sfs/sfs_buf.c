@@ -0,0 +1,608 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * SFS filesystem
+ *
+ * Buffer cache.
+ *
+ * Every block SFS uses, other than the superblock and the free block
+ * bitmap (which are kept in memory whole and written directly), goes
+ * through a fixed pool of SFS_NBUFS block buffers shared by all
+ * mounted volumes and keyed by (device, block). Buffers are found
+ * through a hash table. Buffers not in use sit on an LRU list, and a
+ * miss recycles the least recently used one.
+ *
+ * Writes are delayed. Marking a buffer dirty sets its bit in
+ * sfs_buf_dirtymap, and the block is only written out when its buffer
+ * is recycled or when the volume is synced (sfs_sync, or fsync of any
+ * file on it). A buffer that can't be written back when recycled
+ * stays dirty and goes to the far end of the LRU list, and another one
+ * is recycled instead, so one bad block doesn't stop the cache.
+ *
+ * A buffer handed out by sfs_buf_read or sfs_buf_get is pinned: it
+ * belongs to the caller until sfs_buf_release, is off the LRU list so
+ * it can't be recycled, and anyone else wanting the same block waits
+ * for it. I/O is done with the buffer pinned, but without
+ * sfs_buf_lock held.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <synch.h>
+#include <vfs.h>
+#include <sfs.h>
+#include "sfsprivate.h"
+
+#define SFS_NBUFS	128	/* buffers in the cache */
+#define SFS_BUFHASH	64	/* hash chains */
+
+struct sfs_buf {
+	struct device *b_dev;		/* device the block is on, or NULL */
+	struct sfs_fs *b_sfs;		/* ...and the volume, for doing I/O */
+	daddr_t b_block;		/* block number on the device */
+	unsigned b_index;		/* our bit in sfs_buf_dirtymap */
+	bool b_valid;			/* b_data holds the block */
+	bool b_pinned;			/* handed out to someone */
+	bool b_failed;			/* last write-back failed */
+	struct sfs_buf *b_hashnext;	/* hash chain */
+	struct sfs_buf *b_lruprev;	/* LRU list (unpinned buffers only) */
+	struct sfs_buf *b_lrunext;
+	void *b_data;
+};
+
+/* Everything here is protected by sfs_buf_lock */
+static struct lock *sfs_buf_lock;
+static struct cv *sfs_buf_cv;		/* a pinned buffer was released */
+static struct sfs_buf sfs_bufs[SFS_NBUFS];
+static struct sfs_buf *sfs_buf_hash[SFS_BUFHASH];
+static struct sfs_buf *sfs_buf_lruhead;	/* most recently used */
+static struct sfs_buf *sfs_buf_lrutail;	/* least recently used */
+static struct bitmap *sfs_buf_dirtymap;
+static unsigned sfs_buf_ndirty;
+
+/* Statistics */
+static uint32_t sfs_buf_lookups;	/* sfs_buf_read and sfs_buf_get calls */
+static uint32_t sfs_buf_hits;		/* ...that found the block cached */
+static uint32_t sfs_buf_reads;		/* blocks read from disk */
+static uint32_t sfs_buf_writes;		/* blocks written back */
+static uint32_t sfs_buf_recycled;	/* buffers taken for another block */
+
+////////////////////////////////////////////////////////////
+//
+// Hash table and LRU list
+
+static
+unsigned
+sfs_buf_hashfn(struct device *dev, daddr_t block)
+{
+	return ((uintptr_t)dev / sizeof(void *) + block) % SFS_BUFHASH;
+}
+
+static
+struct sfs_buf *
+sfs_buf_find(struct device *dev, daddr_t block)
+{
+	struct sfs_buf *b;
+
+	for (b = sfs_buf_hash[sfs_buf_hashfn(dev, block)]; b != NULL;
+	     b = b->b_hashnext) {
+		if (b->b_dev == dev && b->b_block == block) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+sfs_buf_hashinsert(struct sfs_buf *b)
+{
+	unsigned h = sfs_buf_hashfn(b->b_dev, b->b_block);
+
+	b->b_hashnext = sfs_buf_hash[h];
+	sfs_buf_hash[h] = b;
+}
+
+static
+void
+sfs_buf_hashremove(struct sfs_buf *b)
+{
+	struct sfs_buf **pb;
+
+	pb = &sfs_buf_hash[sfs_buf_hashfn(b->b_dev, b->b_block)];
+	while (*pb != b) {
+		KASSERT(*pb != NULL);
+		pb = &(*pb)->b_hashnext;
+	}
+	*pb = b->b_hashnext;
+	b->b_hashnext = NULL;
+	b->b_dev = NULL;
+	b->b_sfs = NULL;
+	b->b_valid = false;
+}
+
+static
+void
+sfs_buf_lruremove(struct sfs_buf *b)
+{
+	if (b->b_lruprev != NULL) {
+		b->b_lruprev->b_lrunext = b->b_lrunext;
+	}
+	else {
+		sfs_buf_lruhead = b->b_lrunext;
+	}
+	if (b->b_lrunext != NULL) {
+		b->b_lrunext->b_lruprev = b->b_lruprev;
+	}
+	else {
+		sfs_buf_lrutail = b->b_lruprev;
+	}
+	b->b_lruprev = b->b_lrunext = NULL;
+}
+
+/* Put B on the LRU list, as most recently used or as next to recycle */
+static
+void
+sfs_buf_lruinsert(struct sfs_buf *b, bool recent)
+{
+	if (recent) {
+		b->b_lruprev = NULL;
+		b->b_lrunext = sfs_buf_lruhead;
+		if (sfs_buf_lruhead != NULL) {
+			sfs_buf_lruhead->b_lruprev = b;
+		}
+		else {
+			sfs_buf_lrutail = b;
+		}
+		sfs_buf_lruhead = b;
+	}
+	else {
+		b->b_lrunext = NULL;
+		b->b_lruprev = sfs_buf_lrutail;
+		if (sfs_buf_lrutail != NULL) {
+			sfs_buf_lrutail->b_lrunext = b;
+		}
+		else {
+			sfs_buf_lruhead = b;
+		}
+		sfs_buf_lrutail = b;
+	}
+}
+
+static
+void
+sfs_buf_setdirty(struct sfs_buf *b, bool dirty)
+{
+	if (dirty && !bitmap_isset(sfs_buf_dirtymap, b->b_index)) {
+		bitmap_mark(sfs_buf_dirtymap, b->b_index);
+		sfs_buf_ndirty++;
+	}
+	else if (!dirty && bitmap_isset(sfs_buf_dirtymap, b->b_index)) {
+		bitmap_unmark(sfs_buf_dirtymap, b->b_index);
+		sfs_buf_ndirty--;
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Pinning and write-back
+
+/*
+ * Write a pinned buffer back to disk and mark it clean. Called
+ * without sfs_buf_lock.
+ */
+static
+int
+sfs_buf_writeout(struct sfs_buf *b)
+{
+	int result;
+
+	KASSERT(b->b_pinned && b->b_valid);
+
+	result = sfs_writeblock(b->b_sfs, b->b_block, b->b_data,
+				SFS_BLOCKSIZE);
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(sfs_buf_lock);
+	sfs_buf_setdirty(b, false);
+	b->b_failed = false;
+	sfs_buf_writes++;
+	lock_release(sfs_buf_lock);
+	return 0;
+}
+
+/*
+ * Unpin a buffer, putting it back on the LRU list as most recently
+ * used if RECENT, otherwise as next to recycle. Called with
+ * sfs_buf_lock held.
+ */
+static
+void
+sfs_buf_unpin(struct sfs_buf *b, bool recent)
+{
+	KASSERT(b->b_pinned);
+	b->b_pinned = false;
+	if (!b->b_valid && b->b_dev != NULL) {
+		/* Never filled in, so it doesn't hold the block after all */
+		sfs_buf_hashremove(b);
+	}
+	sfs_buf_lruinsert(b, recent && b->b_valid);
+	cv_broadcast(sfs_buf_cv, sfs_buf_lock);
+}
+
+/*
+ * Find the buffer for BLOCK of SFS, recycling the least recently used
+ * buffer if it isn't cached, and pin it. The buffer's contents are
+ * only there if b_valid is set.
+ */
+static
+int
+sfs_buf_pin(struct sfs_fs *sfs, daddr_t block, struct sfs_buf **ret)
+{
+	struct device *dev = sfs->sfs_device;
+	struct sfs_buf *b;
+	unsigned nfailed = 0;
+	int result;
+
+	lock_acquire(sfs_buf_lock);
+	sfs_buf_lookups++;
+	while (1) {
+		b = sfs_buf_find(dev, block);
+		if (b != NULL) {
+			if (b->b_pinned) {
+				cv_wait(sfs_buf_cv, sfs_buf_lock);
+				continue;
+			}
+			if (b->b_valid) {
+				sfs_buf_hits++;
+			}
+			sfs_buf_lruremove(b);
+			break;
+		}
+
+		/* Not cached: recycle the least recently used buffer */
+		b = sfs_buf_lrutail;
+		if (b == NULL) {
+			/* Everything is pinned */
+			cv_wait(sfs_buf_cv, sfs_buf_lock);
+			continue;
+		}
+		sfs_buf_lruremove(b);
+
+		if (bitmap_isset(sfs_buf_dirtymap, b->b_index)) {
+			/*
+			 * Write it back first. Then look again, since
+			 * the lock was dropped and someone may have
+			 * brought our block in meanwhile.
+			 */
+			b->b_pinned = true;
+			lock_release(sfs_buf_lock);
+			result = sfs_buf_writeout(b);
+			lock_acquire(sfs_buf_lock);
+			if (result == 0) {
+				sfs_buf_unpin(b, false);
+				continue;
+			}
+
+			/*
+			 * Keep it, still dirty, but out of the way, and
+			 * try the next one. Only give up if every
+			 * buffer has failed.
+			 */
+			if (!b->b_failed) {
+				kprintf("sfs: %s: block %u: write-back "
+					"failed: %s\n",
+					b->b_sfs->sfs_sb.sb_volname,
+					(unsigned)b->b_block,
+					strerror(result));
+				b->b_failed = true;
+			}
+			sfs_buf_unpin(b, true);
+			if (++nfailed >= SFS_NBUFS) {
+				lock_release(sfs_buf_lock);
+				return result;
+			}
+			continue;
+		}
+
+		if (b->b_dev != NULL) {
+			sfs_buf_hashremove(b);
+			sfs_buf_recycled++;
+		}
+		b->b_dev = dev;
+		b->b_sfs = sfs;
+		b->b_block = block;
+		b->b_valid = false;
+		sfs_buf_hashinsert(b);
+		break;
+	}
+	b->b_pinned = true;
+	lock_release(sfs_buf_lock);
+
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Get a pinned buffer holding BLOCK of SFS, reading it in if it isn't
+ * cached.
+ */
+int
+sfs_buf_read(struct sfs_fs *sfs, daddr_t block, struct sfs_buf **ret)
+{
+	struct sfs_buf *b;
+	int result;
+
+	result = sfs_buf_pin(sfs, block, &b);
+	if (result) {
+		return result;
+	}
+
+	if (!b->b_valid) {
+		result = sfs_readblock(sfs, block, b->b_data, SFS_BLOCKSIZE);
+		if (result) {
+			sfs_buf_release(b);
+			return result;
+		}
+		lock_acquire(sfs_buf_lock);
+		b->b_valid = true;
+		sfs_buf_reads++;
+		lock_release(sfs_buf_lock);
+	}
+
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Get a pinned buffer for BLOCK of SFS without reading it, for a
+ * caller that is about to overwrite the whole block. Unless the block
+ * happened to be cached the contents are garbage; the caller must fill
+ * it in and call sfs_buf_dirty, or the buffer is discarded when
+ * released.
+ */
+int
+sfs_buf_get(struct sfs_fs *sfs, daddr_t block, struct sfs_buf **ret)
+{
+	return sfs_buf_pin(sfs, block, ret);
+}
+
+void *
+sfs_buf_data(struct sfs_buf *b)
+{
+	KASSERT(b->b_pinned);
+	return b->b_data;
+}
+
+/* Whether a pinned buffer holds its block (always, after sfs_buf_read) */
+bool
+sfs_buf_valid(struct sfs_buf *b)
+{
+	KASSERT(b->b_pinned);
+	return b->b_valid;
+}
+
+/*
+ * Mark a pinned buffer as modified (and, after sfs_buf_get, as
+ * holding the block). It is written back later.
+ */
+void
+sfs_buf_dirty(struct sfs_buf *b)
+{
+	lock_acquire(sfs_buf_lock);
+	KASSERT(b->b_pinned);
+	b->b_valid = true;
+	sfs_buf_setdirty(b, true);
+	lock_release(sfs_buf_lock);
+}
+
+/*
+ * Unpin a buffer from sfs_buf_read or sfs_buf_get.
+ */
+void
+sfs_buf_release(struct sfs_buf *b)
+{
+	lock_acquire(sfs_buf_lock);
+	sfs_buf_unpin(b, true);
+	lock_release(sfs_buf_lock);
+}
+
+/*
+ * BLOCK of SFS has been freed: drop any cached copy of it, so it isn't
+ * written back for nothing. A pinned buffer is left alone; whoever has
+ * it is still using the block.
+ */
+void
+sfs_buf_forget(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_buf *b;
+
+	lock_acquire(sfs_buf_lock);
+	b = sfs_buf_find(sfs->sfs_device, block);
+	if (b != NULL && !b->b_pinned) {
+		sfs_buf_setdirty(b, false);
+		sfs_buf_hashremove(b);
+		sfs_buf_lruremove(b);
+		sfs_buf_lruinsert(b, false);
+	}
+	lock_release(sfs_buf_lock);
+}
+
+/*
+ * Write back every dirty buffer of SFS. A buffer someone has pinned is
+ * waited for, since they may be about to dirty it.
+ */
+int
+sfs_buf_sync(struct sfs_fs *sfs)
+{
+	struct sfs_buf *b;
+	unsigned i;
+	int result;
+
+	lock_acquire(sfs_buf_lock);
+	for (i = 0; i < SFS_NBUFS && sfs_buf_ndirty > 0; i++) {
+		b = &sfs_bufs[i];
+		if (b->b_sfs != sfs ||
+		    !bitmap_isset(sfs_buf_dirtymap, b->b_index)) {
+			continue;
+		}
+		if (b->b_pinned) {
+			cv_wait(sfs_buf_cv, sfs_buf_lock);
+			i--;
+			continue;
+		}
+
+		sfs_buf_lruremove(b);
+		b->b_pinned = true;
+		lock_release(sfs_buf_lock);
+		result = sfs_buf_writeout(b);
+		lock_acquire(sfs_buf_lock);
+		sfs_buf_unpin(b, true);
+		if (result) {
+			lock_release(sfs_buf_lock);
+			return result;
+		}
+	}
+	lock_release(sfs_buf_lock);
+	return 0;
+}
+
+/*
+ * Drop every buffer of SFS, on unmount. They must all be clean, which
+ * they are after sfs_sync.
+ */
+void
+sfs_buf_unmount(struct sfs_fs *sfs)
+{
+	struct sfs_buf *b;
+	unsigned i;
+
+	lock_acquire(sfs_buf_lock);
+	for (i = 0; i < SFS_NBUFS; i++) {
+		b = &sfs_bufs[i];
+		if (b->b_sfs != sfs) {
+			continue;
+		}
+		KASSERT(!b->b_pinned);
+		KASSERT(!bitmap_isset(sfs_buf_dirtymap, b->b_index));
+		sfs_buf_hashremove(b);
+		sfs_buf_lruremove(b);
+		sfs_buf_lruinsert(b, false);
+	}
+	lock_release(sfs_buf_lock);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Setup and statistics
+
+/*
+ * Set up the buffer cache, the first time anything is mounted.
+ */
+int
+sfs_buf_init(void)
+{
+	char *data;
+	unsigned i;
+
+	if (sfs_buf_lock != NULL) {
+		return 0;
+	}
+
+	data = kmalloc(SFS_NBUFS * SFS_BLOCKSIZE);
+	if (data == NULL) {
+		return ENOMEM;
+	}
+	sfs_buf_dirtymap = bitmap_create(SFS_NBUFS);
+	if (sfs_buf_dirtymap == NULL) {
+		kfree(data);
+		return ENOMEM;
+	}
+	sfs_buf_cv = cv_create("sfs_buf");
+	if (sfs_buf_cv == NULL) {
+		bitmap_destroy(sfs_buf_dirtymap);
+		kfree(data);
+		return ENOMEM;
+	}
+
+	for (i = 0; i < SFS_NBUFS; i++) {
+		sfs_bufs[i].b_dev = NULL;
+		sfs_bufs[i].b_sfs = NULL;
+		sfs_bufs[i].b_block = 0;
+		sfs_bufs[i].b_index = i;
+		sfs_bufs[i].b_valid = false;
+		sfs_bufs[i].b_pinned = false;
+		sfs_bufs[i].b_failed = false;
+		sfs_bufs[i].b_hashnext = NULL;
+		sfs_bufs[i].b_data = data + i * SFS_BLOCKSIZE;
+		sfs_buf_lruinsert(&sfs_bufs[i], false);
+	}
+
+	/* Set last: it says the rest is ready */
+	sfs_buf_lock = lock_create("sfs_buf");
+	if (sfs_buf_lock == NULL) {
+		cv_destroy(sfs_buf_cv);
+		bitmap_destroy(sfs_buf_dirtymap);
+		kfree(data);
+		sfs_buf_lruhead = sfs_buf_lrutail = NULL;
+		return ENOMEM;
+	}
+	return 0;
+}
+
+/*
+ * Print the hit rate and how much I/O the cache did, and with RESET,
+ * start counting again (to measure one workload at a time).
+ */
+void
+sfs_buf_printstats(bool reset)
+{
+	if (sfs_buf_lock == NULL) {
+		kprintf("sfs buffer cache: nothing mounted yet\n");
+		return;
+	}
+
+	lock_acquire(sfs_buf_lock);
+	kprintf("sfs buffer cache: %u buffers, %u dirty\n",
+		SFS_NBUFS, sfs_buf_ndirty);
+	kprintf("%u lookups, %u hits (%u%%), %u blocks read, "
+		"%u written back, %u buffers recycled\n",
+		sfs_buf_lookups, sfs_buf_hits,
+		sfs_buf_lookups ? sfs_buf_hits * 100 / sfs_buf_lookups : 0,
+		sfs_buf_reads, sfs_buf_writes, sfs_buf_recycled);
+	if (reset) {
+		sfs_buf_lookups = sfs_buf_hits = 0;
+		sfs_buf_reads = sfs_buf_writes = sfs_buf_recycled = 0;
+	}
+	lock_release(sfs_buf_lock);
+}
@@ -95,6 +95,208 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 	return size / sizeof(struct sfs_direntry);
 }
 
+/*
+ * Hashed directories; see kern/sfs.h for the layout.
+ */
+
+#define SFS_DIRPERBLOCK (SFS_BLOCKSIZE / sizeof(struct sfs_direntry))
+
+/*
+ * Hash a name. This has to match what mksfs and sfsck use.
+ */
+static
+uint32_t
+sfs_dir_hash(const char *name)
+{
+	uint32_t h = SFS_DIRHASH_BASIS;
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= SFS_DIRHASH_PRIME;
+	}
+	return h;
+}
+
+/*
+ * Return the number of hash buckets in a directory, or 0 if it isn't
+ * hashed.
+ */
+static
+unsigned
+sfs_dir_nbuckets(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	unsigned nbuckets;
+
+	COMPILE_ASSERT(SFS_DIRHASH_NBUCKETS <= SFS_DIRHASH_MAXBUCKETS);
+	KASSERT(sv->sv_i.sfi_type == SFS_TYPE_DIR);
+
+	nbuckets = sv->sv_i.sfi_dirhash;
+	if (nbuckets == 0) {
+		return 0;
+	}
+	if (nbuckets > SFS_DIRHASH_MAXBUCKETS ||
+	    sv->sv_i.sfi_size != nbuckets * SFS_BLOCKSIZE) {
+		panic("sfs: %s: directory %u: Invalid size %u for %u "
+		      "hash buckets\n", sfs->sfs_sb.sb_volname, sv->sv_ino,
+		      sv->sv_i.sfi_size, nbuckets);
+	}
+	return nbuckets;
+}
+
+/*
+ * Read a whole bucket. Buckets that were never allocated read as empty.
+ */
+static
+int
+sfs_dir_readbucket(struct sfs_vnode *sv, unsigned bucket,
+		   struct sfs_direntry *sds)
+{
+	return sfs_metaio(sv, (off_t)bucket * SFS_BLOCKSIZE, sds,
+			  SFS_BLOCKSIZE, UIO_READ);
+}
+
+/*
+ * sfs_dir_findname for hashed directories. Probe forward from the
+ * name's home bucket; the name can't be past the first bucket with
+ * room in it, and that's where a new entry for it should go.
+ */
+static
+int
+sfs_dir_hashfind(struct sfs_vnode *sv, unsigned nbuckets, const char *name,
+		 uint32_t *ino, int *slot, int *emptyslot)
+{
+	struct sfs_direntry sds[SFS_DIRPERBLOCK];
+	unsigned bucket, n, i;
+	int freeslot, result;
+
+	bucket = sfs_dir_hash(name) % nbuckets;
+	for (n=0; n<nbuckets; n++) {
+		result = sfs_dir_readbucket(sv, bucket, sds);
+		if (result) {
+			return result;
+		}
+
+		freeslot = -1;
+		for (i=0; i<SFS_DIRPERBLOCK; i++) {
+			if (sds[i].sfd_ino == SFS_NOINO) {
+				if (freeslot < 0) {
+					freeslot = bucket*SFS_DIRPERBLOCK + i;
+				}
+				continue;
+			}
+			sds[i].sfd_name[sizeof(sds[i].sfd_name)-1] = 0;
+			if (!strcmp(sds[i].sfd_name, name)) {
+				if (slot != NULL) {
+					*slot = bucket*SFS_DIRPERBLOCK + i;
+				}
+				if (ino != NULL) {
+					*ino = sds[i].sfd_ino;
+				}
+				return 0;
+			}
+		}
+		if (freeslot >= 0) {
+			if (emptyslot != NULL) {
+				*emptyslot = freeslot;
+			}
+			return ENOENT;
+		}
+
+		bucket = (bucket + 1) % nbuckets;
+	}
+
+	/* Every bucket is full. */
+	return ENOENT;
+}
+
+/*
+ * sfs_dir_unlink for hashed directories. Clearing a slot in a full
+ * bucket would cut off the probe path of anything that overflowed past
+ * it, so pull such entries back into the hole (which moves the hole
+ * along) until we get to a bucket that wasn't full.
+ */
+static
+int
+sfs_dir_hashunlink(struct sfs_vnode *sv, unsigned nbuckets, int slot)
+{
+	struct sfs_direntry sds[SFS_DIRPERBLOCK];
+	struct sfs_direntry empty;
+	unsigned hole, bucket, home, n, i, move;
+	bool full;
+	int result;
+
+	bzero(&empty, sizeof(empty));
+	empty.sfd_ino = SFS_NOINO;
+
+	hole = slot / SFS_DIRPERBLOCK;
+	result = sfs_dir_readbucket(sv, hole, sds);
+	if (result) {
+		return result;
+	}
+	full = true;
+	for (i=0; i<SFS_DIRPERBLOCK; i++) {
+		if (sds[i].sfd_ino == SFS_NOINO) {
+			full = false;
+		}
+	}
+
+	result = sfs_writedir(sv, slot, &empty);
+	if (result) {
+		return result;
+	}
+	if (!full) {
+		/* Nothing can have overflowed past this bucket. */
+		return 0;
+	}
+
+	bucket = hole;
+	for (n=1; n<nbuckets; n++) {
+		bucket = (bucket + 1) % nbuckets;
+		result = sfs_dir_readbucket(sv, bucket, sds);
+		if (result) {
+			return result;
+		}
+
+		/* Find an entry that would have gone in the hole's bucket. */
+		full = true;
+		move = SFS_DIRPERBLOCK;
+		for (i=0; i<SFS_DIRPERBLOCK; i++) {
+			if (sds[i].sfd_ino == SFS_NOINO) {
+				full = false;
+				continue;
+			}
+			if (move < SFS_DIRPERBLOCK) {
+				continue;
+			}
+			sds[i].sfd_name[sizeof(sds[i].sfd_name)-1] = 0;
+			home = sfs_dir_hash(sds[i].sfd_name) % nbuckets;
+			if ((hole + nbuckets - home) % nbuckets <
+			    (bucket + nbuckets - home) % nbuckets) {
+				move = i;
+			}
+		}
+
+		if (move < SFS_DIRPERBLOCK) {
+			result = sfs_writedir(sv, slot, &sds[move]);
+			if (result) {
+				return result;
+			}
+			slot = bucket*SFS_DIRPERBLOCK + move;
+			result = sfs_writedir(sv, slot, &empty);
+			if (result) {
+				return result;
+			}
+			hole = bucket;
+		}
+		if (!full) {
+			break;
+		}
+	}
+
+	return 0;
+}
+
 /*
  * Search a directory for a particular filename in a directory, and
  * return its inode number, its slot, and/or the slot number of an
@@ -105,8 +307,15 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 		uint32_t *ino, int *slot, int *emptyslot)
 {
 	struct sfs_direntry tsd;
+	unsigned nbuckets;
 	int found, nentries, i, result;
 
+	nbuckets = sfs_dir_nbuckets(sv);
+	if (nbuckets > 0) {
+		return sfs_dir_hashfind(sv, nbuckets, name,
+					ino, slot, emptyslot);
+	}
+
 	nentries = sfs_dir_nentries(sv);
 
 	/* For each slot... */
@@ -170,8 +379,14 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 		return ENAMETOOLONG;
 	}
 
-	/* If we didn't get an empty slot, add the entry at the end. */
+	/*
+	 * If we didn't get an empty slot, add the entry at the end;
+	 * unless the directory is hashed, in which case it's full.
+	 */
 	if (emptyslot < 0) {
+		if (sfs_dir_nbuckets(sv) > 0) {
+			return ENOSPC;
+		}
 		emptyslot = sfs_dir_nentries(sv);
 	}
 
@@ -190,12 +405,20 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 }
 
 /*
- * Unlink a name in a directory, by slot number.
+ * Unlink a name in a directory, by slot number. In a hashed directory
+ * this may move other entries, so other slot numbers the caller has
+ * are no longer good afterwards.
  */
 int
 sfs_dir_unlink(struct sfs_vnode *sv, int slot)
 {
 	struct sfs_direntry sd;
+	unsigned nbuckets;
+
+	nbuckets = sfs_dir_nbuckets(sv);
+	if (nbuckets > 0) {
+		return sfs_dir_hashunlink(sv, nbuckets, slot);
+	}
 
 	/* Initialize a suitable directory entry... */
 	bzero(&sd, sizeof(sd));
@@ -38,6 +38,7 @@
 #include <lib.h>
 #include <array.h>
 #include <bitmap.h>
+#include <synch.h>
 #include <uio.h>
 #include <vfs.h>
 #include <device.h>
@@ -107,19 +108,44 @@ sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 
 /*
  * Sync routine for the vnode table.
+ *
+ * VOP_FSYNC takes the vnode's lock, which comes before the vnode
+ * table lock, so we can't sync while holding the table. Instead take
+ * a reference to everything that's loaded, drop the table lock, and
+ * sync from that snapshot.
  */
 static
 int
 sfs_sync_vnodes(struct sfs_fs *sfs)
 {
+	struct vnode **vs;
 	unsigned i, num;
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
+	lock_acquire(sfs->sfs_vnlock);
 	num = vnodearray_num(sfs->sfs_vnodes);
+	if (num == 0) {
+		lock_release(sfs->sfs_vnlock);
+		return 0;
+	}
+	vs = kmalloc(num * sizeof(struct vnode *));
+	if (vs == NULL) {
+		lock_release(sfs->sfs_vnlock);
+		return ENOMEM;
+	}
+	for (i=0; i<num; i++) {
+		vs[i] = vnodearray_get(sfs->sfs_vnodes, i);
+		VOP_INCREF(vs[i]);
+	}
+	lock_release(sfs->sfs_vnlock);
+
+	/* Go over the snapshot, syncing as we go. */
 	for (i=0; i<num; i++) {
-		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
-		VOP_FSYNC(v);
+		VOP_FSYNC(vs[i]);
 	}
+	for (i=0; i<num; i++) {
+		VOP_DECREF(vs[i]);
+	}
+	kfree(vs);
 	return 0;
 }
 
@@ -132,13 +158,16 @@ sfs_sync_freemap(struct sfs_fs *sfs)
 {
 	int result;
 
+	lock_acquire(sfs->sfs_freemaplock);
 	if (sfs->sfs_freemapdirty) {
 		result = sfs_freemapio(sfs, UIO_WRITE);
 		if (result) {
+			lock_release(sfs->sfs_freemaplock);
 			return result;
 		}
 		sfs->sfs_freemapdirty = false;
 	}
+	lock_release(sfs->sfs_freemaplock);
 
 	return 0;
 }
@@ -174,7 +203,8 @@ sfs_sync(struct fs *fs)
 	struct sfs_fs *sfs;
 	int result;
 
-	vfs_biglock_acquire();
+	/* vfs_sync and vfs_unmount serialize us against unmount */
+	KASSERT(vfs_biglock_do_i_hold());
 
 	/*
 	 * Get the sfs_fs from the generic abstract fs.
@@ -211,25 +241,27 @@ sfs_sync(struct fs *fs)
 	/* If any vnodes need to be written, write them. */
 	result = sfs_sync_vnodes(sfs);
 	if (result) {
-		vfs_biglock_release();
+		return result;
+	}
+
+	/* Write back the dirty buffers (including those inodes). */
+	result = sfs_buf_sync(sfs);
+	if (result) {
 		return result;
 	}
 
 	/* If the free block map needs to be written, write it. */
 	result = sfs_sync_freemap(sfs);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	/* If the superblock needs to be written, write it. */
 	result = sfs_sync_superblock(sfs);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -243,13 +275,9 @@ const char *
 sfs_getvolname(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
-	const char *ret;
 
-	vfs_biglock_acquire();
-	ret = sfs->sfs_sb.sb_volname;
-	vfs_biglock_release();
-
-	return ret;
+	/* The volume name never changes while we're mounted */
+	return sfs->sfs_sb.sb_volname;
 }
 
 /*
@@ -263,6 +291,8 @@ sfs_fs_destroy(struct sfs_fs *sfs)
 		bitmap_destroy(sfs->sfs_freemap);
 	}
 	vnodearray_destroy(sfs->sfs_vnodes);
+	lock_destroy(sfs->sfs_freemaplock);
+	lock_destroy(sfs->sfs_vnlock);
 	KASSERT(sfs->sfs_device == NULL);
 	kfree(sfs);
 }
@@ -278,18 +308,24 @@ sfs_unmount(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
 
-	vfs_biglock_acquire();
+	/* vfs_unmount holds the big lock, so no new lookups can start */
+	KASSERT(vfs_biglock_do_i_hold());
 
 	/* Do we have any files open? If so, can't unmount. */
+	lock_acquire(sfs->sfs_vnlock);
 	if (vnodearray_num(sfs->sfs_vnodes) > 0) {
-		vfs_biglock_release();
+		lock_release(sfs->sfs_vnlock);
 		return EBUSY;
 	}
+	lock_release(sfs->sfs_vnlock);
 
 	/* We should have just had sfs_sync called. */
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
 
+	/* Drop our (clean, after sfs_sync) blocks from the buffer cache */
+	sfs_buf_unmount(sfs);
+
 	/* The vfs layer takes care of the device for us */
 	sfs->sfs_device = NULL;
 
@@ -297,7 +333,6 @@ sfs_unmount(struct fs *fs)
 	sfs_fs_destroy(sfs);
 
 	/* nothing else to do */
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -321,6 +356,7 @@ struct sfs_fs *
 sfs_fs_create(void)
 {
 	struct sfs_fs *sfs;
+	unsigned i;
 
 	/*
 	 * Make sure our on-disk structures aren't messed up
@@ -355,13 +391,28 @@ sfs_fs_create(void)
 	if (sfs->sfs_vnodes == NULL) {
 		goto cleanup_object;
 	}
+	for (i=0; i<SFS_VNHASH; i++) {
+		sfs->sfs_vnhash[i] = NULL;
+	}
+	sfs->sfs_vnlock = lock_create("sfs_vnodes");
+	if (sfs->sfs_vnlock == NULL) {
+		goto cleanup_vnodes;
+	}
 
 	/* freemap */
 	sfs->sfs_freemap = NULL;
 	sfs->sfs_freemapdirty = false;
+	sfs->sfs_freemaplock = lock_create("sfs_freemap");
+	if (sfs->sfs_freemaplock == NULL) {
+		goto cleanup_vnlock;
+	}
 
 	return sfs;
 
+cleanup_vnlock:
+	lock_destroy(sfs->sfs_vnlock);
+cleanup_vnodes:
+	vnodearray_destroy(sfs->sfs_vnodes);
 cleanup_object:
 	kfree(sfs);
 fail:
@@ -388,8 +439,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	int result;
 	struct sfs_fs *sfs;
 
-	vfs_biglock_acquire();
-
 	/* We don't pass any options through mount */
 	(void)options;
 
@@ -402,15 +451,23 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	 * don't do that in sfs.)
 	 */
 	if (dev->d_blocksize != SFS_BLOCKSIZE) {
-		vfs_biglock_release();
 		kprintf("sfs: Cannot mount on device with blocksize %zu\n",
 			dev->d_blocksize);
 		return ENXIO;
 	}
 
+	/*
+	 * The buffer cache is set up by the first mount; vfs_mount
+	 * holds the big lock, so two mounts can't both try.
+	 */
+	KASSERT(vfs_biglock_do_i_hold());
+	result = sfs_buf_init();
+	if (result) {
+		return result;
+	}
+
 	sfs = sfs_fs_create();
 	if (sfs == NULL) {
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 
@@ -423,7 +480,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	if (result) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -436,7 +492,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 			SFS_MAGIC);
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return EINVAL;
 	}
 
@@ -453,21 +508,18 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	if (sfs->sfs_freemap == NULL) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 	result = sfs_freemapio(sfs, UIO_READ);
 	if (result) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return result;
 	}
 
 	/* Hand back the abstract fs */
 	*ret = &sfs->sfs_absfs;
 
-	vfs_biglock_release();
 	return 0;
 }
 
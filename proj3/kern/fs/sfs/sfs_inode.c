@@ -35,31 +35,120 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <vfs.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 
 /*
- * Write an on-disk inode structure back out to disk.
+ * Write an on-disk inode structure back out to its buffer, from where
+ * it goes to disk with the next sync. The caller holds the vnode's
+ * lock (or, in sfs_reclaim, the only reference).
  */
 int
 sfs_sync_inode(struct sfs_vnode *sv)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *buf;
 	int result;
 
 	if (sv->sv_dirty) {
-		result = sfs_writeblock(sfs, sv->sv_ino, &sv->sv_i,
-					sizeof(sv->sv_i));
+		result = sfs_buf_get(sfs, sv->sv_ino, &buf);
 		if (result) {
 			return result;
 		}
+		memcpy(sfs_buf_data(buf), &sv->sv_i, sizeof(sv->sv_i));
+		sfs_buf_dirty(buf);
+		sfs_buf_release(buf);
 		sv->sv_dirty = false;
 	}
 	return 0;
 }
 
+/*
+ * The table of loaded vnodes. Each vnode is both in the sfs_vnodes
+ * array, for code that wants to go over all of them, and on a hash
+ * chain keyed by inode number, for lookups. It remembers its index in
+ * the array so it can be taken out without a search. All of this is
+ * under sfs_vnlock.
+ */
+
+static
+unsigned
+sfs_vnhashfn(uint32_t ino)
+{
+	return ino % SFS_VNHASH;
+}
+
+static
+struct sfs_vnode *
+sfs_vnfind(struct sfs_fs *sfs, uint32_t ino)
+{
+	struct sfs_vnode *sv;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	for (sv = sfs->sfs_vnhash[sfs_vnhashfn(ino)]; sv != NULL;
+	     sv = sv->sv_hashnext) {
+		if (sv->sv_ino == ino) {
+			return sv;
+		}
+	}
+	return NULL;
+}
+
+static
+int
+sfs_vnadd(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	unsigned h = sfs_vnhashfn(sv->sv_ino);
+	int result;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn,
+				&sv->sv_index);
+	if (result) {
+		return result;
+	}
+	sv->sv_hashnext = sfs->sfs_vnhash[h];
+	sfs->sfs_vnhash[h] = sv;
+	return 0;
+}
+
+static
+void
+sfs_vnremove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct sfs_vnode **psv;
+	struct vnode *last;
+	unsigned num;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	psv = &sfs->sfs_vnhash[sfs_vnhashfn(sv->sv_ino)];
+	while (*psv != sv) {
+		if (*psv == NULL) {
+			panic("sfs: %s: reclaim vnode %u not in vnode pool\n",
+			      sfs->sfs_sb.sb_volname, sv->sv_ino);
+		}
+		psv = &(*psv)->sv_hashnext;
+	}
+	*psv = sv->sv_hashnext;
+	sv->sv_hashnext = NULL;
+
+	/* Move the last entry of the array into the hole */
+	num = vnodearray_num(sfs->sfs_vnodes);
+	KASSERT(sv->sv_index < num);
+	KASSERT(vnodearray_get(sfs->sfs_vnodes, sv->sv_index) ==
+		&sv->sv_absvn);
+	last = vnodearray_get(sfs->sfs_vnodes, num - 1);
+	vnodearray_set(sfs->sfs_vnodes, sv->sv_index, last);
+	((struct sfs_vnode *)last->vn_data)->sv_index = sv->sv_index;
+	vnodearray_setsize(sfs->sfs_vnodes, num - 1);
+}
+
 /*
  * Called when the vnode refcount (in-memory usage count) hits zero.
  *
@@ -70,15 +159,17 @@ sfs_reclaim(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
-	unsigned ix, i, num;
 	int result;
 
-	vfs_biglock_acquire();
+	/*
+	 * Holding the vnode table lock keeps sfs_loadvnode from handing
+	 * out the vnode again while we get rid of it.
+	 */
+	lock_acquire(sfs->sfs_vnlock);
 
 	/*
 	 * Make sure someone else hasn't picked up the vnode since the
-	 * decision was made to reclaim it. (You must also synchronize
-	 * this with sfs_loadvnode.)
+	 * decision was made to reclaim it.
 	 */
 	spinlock_acquire(&v->vn_countlock);
 	if (v->vn_refcount != 1) {
@@ -88,16 +179,21 @@ sfs_reclaim(struct vnode *v)
 		v->vn_refcount--;
 
 		spinlock_release(&v->vn_countlock);
-		vfs_biglock_release();
+		lock_release(sfs->sfs_vnlock);
 		return EBUSY;
 	}
 	spinlock_release(&v->vn_countlock);
 
+	/*
+	 * Nobody else can get at the vnode now, so the vnode's own lock
+	 * isn't needed below.
+	 */
+
 	/* If there are no on-disk references to the file either, erase it. */
 	if (sv->sv_i.sfi_linkcount == 0) {
 		result = sfs_itrunc(sv, 0);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sfs->sfs_vnlock);
 			return result;
 		}
 	}
@@ -105,7 +201,7 @@ sfs_reclaim(struct vnode *v)
 	/* Sync the inode to disk */
 	result = sfs_sync_inode(sv);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
@@ -115,27 +211,14 @@ sfs_reclaim(struct vnode *v)
 	}
 
 	/* Remove the vnode structure from the table in the struct sfs_fs. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	ix = num;
-	for (i=0; i<num; i++) {
-		struct vnode *v2 = vnodearray_get(sfs->sfs_vnodes, i);
-		struct sfs_vnode *sv2 = v2->vn_data;
-		if (sv2 == sv) {
-			ix = i;
-			break;
-		}
-	}
-	if (ix == num) {
-		panic("sfs: %s: reclaim vnode %u not in vnode pool\n",
-		      sfs->sfs_sb.sb_volname, sv->sv_ino);
-	}
-	vnodearray_remove(sfs->sfs_vnodes, ix);
+	sfs_vnremove(sfs, sv);
 
 	vnode_cleanup(&sv->sv_absvn);
 
-	vfs_biglock_release();
+	lock_release(sfs->sfs_vnlock);
 
 	/* Release the storage for the vnode structure itself. */
+	lock_destroy(sv->sv_lock);
 	kfree(sv);
 
 	/* Done */
@@ -144,48 +227,49 @@ sfs_reclaim(struct vnode *v)
 
 /*
  * Function to load a inode into memory as a vnode, or dig up one
- * that's already resident.
+ * that's already resident. Takes the vnode table lock, so must not be
+ * called with it held.
  */
 int
 sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		 struct sfs_vnode **ret)
 {
-	struct vnode *v;
 	struct sfs_vnode *sv;
+	struct sfs_buf *buf;
 	const struct vnode_ops *ops;
-	unsigned i, num;
 	int result;
 
-	/* Look in the vnodes table */
-	num = vnodearray_num(sfs->sfs_vnodes);
-
-	/* Linear search. Is this too slow? You decide. */
-	for (i=0; i<num; i++) {
-		v = vnodearray_get(sfs->sfs_vnodes, i);
-		sv = v->vn_data;
+	lock_acquire(sfs->sfs_vnlock);
 
+	/* Look in the vnodes table */
+	sv = sfs_vnfind(sfs, ino);
+	if (sv != NULL) {
 		/* Every inode in memory must be in an allocated block */
 		if (!sfs_bused(sfs, sv->sv_ino)) {
 			panic("sfs: %s: Found inode %u in unallocated block\n",
 			      sfs->sfs_sb.sb_volname, sv->sv_ino);
 		}
 
-		if (sv->sv_ino==ino) {
-			/* Found */
-
-			/* forcetype is only allowed when creating objects */
-			KASSERT(forcetype==SFS_TYPE_INVAL);
+		/* forcetype is only allowed when creating objects */
+		KASSERT(forcetype==SFS_TYPE_INVAL);
 
-			VOP_INCREF(&sv->sv_absvn);
-			*ret = sv;
-			return 0;
-		}
+		VOP_INCREF(&sv->sv_absvn);
+		lock_release(sfs->sfs_vnlock);
+		*ret = sv;
+		return 0;
 	}
 
 	/* Didn't have it loaded; load it */
 
 	sv = kmalloc(sizeof(struct sfs_vnode));
 	if (sv==NULL) {
+		lock_release(sfs->sfs_vnlock);
+		return ENOMEM;
+	}
+	sv->sv_lock = lock_create("sfs_vnode");
+	if (sv->sv_lock == NULL) {
+		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return ENOMEM;
 	}
 
@@ -196,11 +280,15 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	}
 
 	/* Read the block the inode is in */
-	result = sfs_readblock(sfs, ino, &sv->sv_i, sizeof(sv->sv_i));
+	result = sfs_buf_read(sfs, ino, &buf);
 	if (result) {
+		lock_destroy(sv->sv_lock);
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
+	memcpy(&sv->sv_i, sfs_buf_data(buf), sizeof(sv->sv_i));
+	sfs_buf_release(buf);
 
 	/* Not dirty yet */
 	sv->sv_dirty = false;
@@ -235,21 +323,28 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = vnode_init(&sv->sv_absvn, ops, &sfs->sfs_absfs, sv);
 	if (result) {
+		lock_destroy(sv->sv_lock);
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
 	/* Set the other fields in our vnode structure */
 	sv->sv_ino = ino;
+	sv->sv_hashnext = NULL;
 
 	/* Add it to our table */
-	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn, NULL);
+	result = sfs_vnadd(sfs, sv);
 	if (result) {
 		vnode_cleanup(&sv->sv_absvn);
+		lock_destroy(sv->sv_lock);
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
+	lock_release(sfs->sfs_vnlock);
+
 	/* Hand it back */
 	*ret = sv;
 	return 0;
@@ -296,25 +391,19 @@ sfs_getroot(struct fs *fs, struct vnode **ret)
 	struct sfs_vnode *sv;
 	int result;
 
-	vfs_biglock_acquire();
-
 	result = sfs_loadvnode(sfs, SFS_ROOTDIR_INO, SFS_TYPE_INVAL, &sv);
 	if (result) {
 		kprintf("sfs: %s: getroot: Cannot load root vnode\n",
 			sfs->sfs_sb.sb_volname);
-		vfs_biglock_release();
 		return result;
 	}
 
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
 		kprintf("sfs: %s: getroot: not directory (type %u)\n",
 			sfs->sfs_sb.sb_volname, sv->sv_i.sfi_type);
-		vfs_biglock_release();
 		return EINVAL;
 	}
 
-	vfs_biglock_release();
-
 	*ret = &sv->sv_absvn;
 	return 0;
 }
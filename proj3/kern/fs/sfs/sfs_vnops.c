@@ -37,6 +37,7 @@
 #include <kern/fcntl.h>
 #include <stat.h>
 #include <lib.h>
+#include <synch.h>
 #include <uio.h>
 #include <vfs.h>
 #include <sfs.h>
@@ -45,6 +46,14 @@
 ////////////////////////////////////////////////////////////
 // Vnode operations.
 
+/*
+ * Locking: each vnode's sv_lock covers its inode and its contents.
+ * Operations on a directory lock the directory first and then, if
+ * they change a file's link count, the file. References are dropped
+ * only after all the vnode locks are released, since the last
+ * VOP_DECREF goes to sfs_reclaim, which takes the vnode table lock.
+ */
+
 /*
  * This is called on *each* open().
  */
@@ -90,6 +99,84 @@ sfs_eachopendir(struct vnode *v, int openflags)
 	return 0;
 }
 
+/*
+ * Largest piece of a user transfer that goes through the kernel at
+ * once. Bigger reads and writes aren't atomic with respect to other
+ * readers and writers of the file.
+ */
+#define SFS_BOUNCESIZE  (8 * SFS_BLOCKSIZE)
+
+/*
+ * Do I/O on a file under its lock. Kernel buffers go straight to
+ * sfs_io. User buffers are copied through a per-call kernel buffer
+ * so the copy happens with the lock dropped: touching the user page
+ * can fault, and the fault may need to read this file (or another
+ * one) through the page cache.
+ *
+ * If a user write fails, UIO may have been advanced past what was
+ * written; the error is all the caller gets back in that case.
+ */
+static
+int
+sfs_lockedio(struct sfs_vnode *sv, struct uio *uio)
+{
+	struct iovec iov;
+	struct uio ku;
+	char *buf;
+	size_t len, done;
+	off_t pos;
+	int result = 0;
+
+	if (uio->uio_segflg == UIO_SYSSPACE) {
+		lock_acquire(sv->sv_lock);
+		result = sfs_io(sv, uio);
+		lock_release(sv->sv_lock);
+		return result;
+	}
+
+	if (uio->uio_resid == 0) {
+		return 0;
+	}
+	buf = kmalloc(uio->uio_resid < SFS_BOUNCESIZE ?
+		      uio->uio_resid : SFS_BOUNCESIZE);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+
+	while (uio->uio_resid > 0) {
+		len = uio->uio_resid < SFS_BOUNCESIZE ?
+			uio->uio_resid : SFS_BOUNCESIZE;
+		pos = uio->uio_offset;
+
+		if (uio->uio_rw == UIO_WRITE) {
+			result = uiomove(buf, len, uio);
+			if (result) {
+				break;
+			}
+		}
+
+		uio_kinit(&iov, &ku, buf, len, pos, uio->uio_rw);
+		lock_acquire(sv->sv_lock);
+		result = sfs_io(sv, &ku);
+		lock_release(sv->sv_lock);
+		if (result) {
+			break;
+		}
+
+		if (uio->uio_rw == UIO_READ) {
+			/* Stop at EOF */
+			done = len - ku.uio_resid;
+			result = uiomove(buf, done, uio);
+			if (result || done < len) {
+				break;
+			}
+		}
+	}
+
+	kfree(buf);
+	return result;
+}
+
 /*
  * Called for read(). sfs_io() does the work.
  */
@@ -102,9 +189,7 @@ sfs_read(struct vnode *v, struct uio *uio)
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
-	vfs_biglock_acquire();
-	result = sfs_io(sv, uio);
-	vfs_biglock_release();
+	result = sfs_lockedio(sv, uio);
 
 	return result;
 }
@@ -121,9 +206,7 @@ sfs_write(struct vnode *v, struct uio *uio)
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
-	vfs_biglock_acquire();
-	result = sfs_io(sv, uio);
-	vfs_biglock_release();
+	result = sfs_lockedio(sv, uio);
 
 	return result;
 }
@@ -164,8 +247,10 @@ sfs_stat(struct vnode *v, struct stat *statbuf)
 		return result;
 	}
 
+	lock_acquire(sv->sv_lock);
 	statbuf->st_size = sv->sv_i.sfi_size;
 	statbuf->st_nlink = sv->sv_i.sfi_linkcount;
+	lock_release(sv->sv_lock);
 
 	/* We don't support this yet */
 	statbuf->st_blocks = 0;
@@ -176,7 +261,8 @@ sfs_stat(struct vnode *v, struct stat *statbuf)
 }
 
 /*
- * Return the type of the file (types as per kern/stat.h)
+ * Return the type of the file (types as per kern/stat.h). The type
+ * never changes once the vnode is loaded, so no lock is needed.
  */
 static
 int
@@ -185,16 +271,12 @@ sfs_gettype(struct vnode *v, uint32_t *ret)
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
 
-	vfs_biglock_acquire();
-
 	switch (sv->sv_i.sfi_type) {
 	case SFS_TYPE_FILE:
 		*ret = S_IFREG;
-		vfs_biglock_release();
 		return 0;
 	case SFS_TYPE_DIR:
 		*ret = S_IFDIR;
-		vfs_biglock_release();
 		return 0;
 	}
 	panic("sfs: %s: gettype: Invalid inode type (inode %u, type %u)\n",
@@ -216,30 +298,46 @@ sfs_isseekable(struct vnode *v)
 /*
  * Called for fsync(), and also on filesystem unmount, global sync(),
  * and some other cases.
+ *
+ * The buffer cache doesn't know which file a block belongs to, so
+ * this writes back every dirty buffer of the volume.
  */
 static
 int
 sfs_fsync(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	int result;
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 	result = sfs_sync_inode(sv);
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
+	if (result == 0) {
+		result = sfs_buf_sync(sfs);
+	}
 
 	return result;
 }
 
 /*
- * Called for mmap().
+ * Called for mmap(). Only regular files get here (directories use
+ * vopfail_mmap_isdir). The pages themselves go through sfs_read and
+ * sfs_write, so any range of the file can be mapped; the part past
+ * the end of the file reads as zeros and is never written back.
  */
 static
 int
-sfs_mmap(struct vnode *v   /* add stuff as needed */)
+sfs_mmap(struct vnode *v, off_t offset, size_t len)
 {
-	(void)v;
-	return ENOSYS;
+	struct sfs_vnode *sv = v->vn_data;
+
+	KASSERT(sv->sv_i.sfi_type == SFS_TYPE_FILE);
+
+	if (offset < 0 || len == 0) {
+		return EINVAL;
+	}
+	return 0;
 }
 
 /*
@@ -250,8 +348,13 @@ int
 sfs_truncate(struct vnode *v, off_t len)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	int result;
 
-	return sfs_itrunc(sv, len);
+	lock_acquire(sv->sv_lock);
+	result = sfs_itrunc(sv, len);
+	lock_release(sv->sv_lock);
+
+	return result;
 }
 
 /*
@@ -289,18 +392,18 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	uint32_t ino;
 	int result;
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 
 	/* Look up the name */
 	result = sfs_dir_findname(sv, name, &ino, NULL, NULL);
 	if (result!=0 && result!=ENOENT) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
 	/* If it exists and we didn't want it to, fail */
 	if (result==0 && excl) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return EEXIST;
 	}
 
@@ -308,18 +411,18 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 		/* We got something; load its vnode and return */
 		result = sfs_loadvnode(sfs, ino, SFS_TYPE_INVAL, &newguy);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sv->sv_lock);
 			return result;
 		}
 		*ret = &newguy->sv_absvn;
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return 0;
 	}
 
 	/* Didn't exist - create it */
 	result = sfs_makeobj(sfs, SFS_TYPE_FILE, &newguy);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
@@ -329,20 +432,22 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	/* Link it into the directory */
 	result = sfs_dir_link(sv, name, newguy->sv_ino, NULL);
 	if (result) {
+		lock_release(sv->sv_lock);
 		VOP_DECREF(&newguy->sv_absvn);
-		vfs_biglock_release();
 		return result;
 	}
 
 	/* Update the linkcount of the new file */
+	lock_acquire(newguy->sv_lock);
 	newguy->sv_i.sfi_linkcount++;
 
 	/* and consequently mark it dirty. */
 	newguy->sv_dirty = true;
+	lock_release(newguy->sv_lock);
 
 	*ret = &newguy->sv_absvn;
 
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 	return 0;
 }
 
@@ -361,26 +466,27 @@ sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 
 	KASSERT(file->vn_fs == dir->vn_fs);
 
-	vfs_biglock_acquire();
-
 	/* Hard links to directories aren't allowed. */
 	if (f->sv_i.sfi_type == SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return EINVAL;
 	}
 
+	lock_acquire(sv->sv_lock);
+
 	/* Create the link */
 	result = sfs_dir_link(sv, name, f->sv_ino, NULL);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
 	/* and update the link count, marking the inode dirty */
+	lock_acquire(f->sv_lock);
 	f->sv_i.sfi_linkcount++;
 	f->sv_dirty = true;
+	lock_release(f->sv_lock);
 
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 	return 0;
 }
 
@@ -396,28 +502,39 @@ sfs_remove(struct vnode *dir, const char *name)
 	int slot;
 	int result;
 
-	vfs_biglock_acquire();
+	/* A hashed root has . and .. entries; those stay put */
+	if (!strcmp(name, ".") || !strcmp(name, "..")) {
+		return EINVAL;
+	}
+
+	lock_acquire(sv->sv_lock);
 
 	/* Look for the file and fetch a vnode for it. */
 	result = sfs_lookonce(sv, name, &victim, &slot);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
+	/* We don't support subdirectories */
+	KASSERT(victim != sv);
+
 	/* Erase its directory entry. */
 	result = sfs_dir_unlink(sv, slot);
 	if (result==0) {
 		/* If we succeeded, decrement the link count. */
+		lock_acquire(victim->sv_lock);
 		KASSERT(victim->sv_i.sfi_linkcount > 0);
 		victim->sv_i.sfi_linkcount--;
 		victim->sv_dirty = true;
+		lock_release(victim->sv_lock);
 	}
 
+	lock_release(sv->sv_lock);
+
 	/* Discard the reference that sfs_lookonce got us */
 	VOP_DECREF(&victim->sv_absvn);
 
-	vfs_biglock_release();
 	return result;
 }
 
@@ -438,15 +555,20 @@ sfs_rename(struct vnode *d1, const char *n1,
 	int slot1, slot2;
 	int result, result2;
 
-	vfs_biglock_acquire();
-
 	KASSERT(d1==d2);
 	KASSERT(sv->sv_ino == SFS_ROOTDIR_INO);
 
+	if (!strcmp(n1, ".") || !strcmp(n1, "..") ||
+	    !strcmp(n2, ".") || !strcmp(n2, "..")) {
+		return EINVAL;
+	}
+
+	lock_acquire(sv->sv_lock);
+
 	/* Look up the old name of the file and get its inode and slot number*/
 	result = sfs_lookonce(sv, n1, &g1, &slot1);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
@@ -467,8 +589,10 @@ sfs_rename(struct vnode *d1, const char *n1,
 	}
 
 	/* Increment the link count, and mark inode dirty */
+	lock_acquire(g1->sv_lock);
 	g1->sv_i.sfi_linkcount++;
 	g1->sv_dirty = true;
+	lock_release(g1->sv_lock);
 
 	/* Unlink the old slot */
 	result = sfs_dir_unlink(sv, slot1);
@@ -480,21 +604,28 @@ sfs_rename(struct vnode *d1, const char *n1,
 	 * Decrement the link count again, and mark the inode dirty again,
 	 * in case it's been synced behind our back.
 	 */
+	lock_acquire(g1->sv_lock);
 	KASSERT(g1->sv_i.sfi_linkcount>0);
 	g1->sv_i.sfi_linkcount--;
 	g1->sv_dirty = true;
+	lock_release(g1->sv_lock);
+
+	lock_release(sv->sv_lock);
 
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_absvn);
 
-	vfs_biglock_release();
 	return 0;
 
  puke_harder:
 	/*
-	 * Error recovery: try to undo what we already did
+	 * Error recovery: try to undo what we already did. In a hashed
+	 * directory the new entry may have moved, so find it again.
 	 */
-	result2 = sfs_dir_unlink(sv, slot2);
+	result2 = sfs_dir_findname(sv, n2, NULL, &slot2, NULL);
+	if (result2 == 0) {
+		result2 = sfs_dir_unlink(sv, slot2);
+	}
 	if (result2) {
 		kprintf("sfs: %s: rename: %s\n",
 			sfs->sfs_sb.sb_volname, strerror(result));
@@ -503,11 +634,13 @@ sfs_rename(struct vnode *d1, const char *n1,
 		panic("sfs: %s: rename: Cannot recover\n",
 		      sfs->sfs_sb.sb_volname);
 	}
+	lock_acquire(g1->sv_lock);
 	g1->sv_i.sfi_linkcount--;
+	lock_release(g1->sv_lock);
  puke:
+	lock_release(sv->sv_lock);
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_absvn);
-	vfs_biglock_release();
 	return result;
 }
 
@@ -525,15 +658,11 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 {
 	struct sfs_vnode *sv = v->vn_data;
 
-	vfs_biglock_acquire();
-
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return ENOTDIR;
 	}
 
 	if (strlen(path)+1 > buflen) {
-		vfs_biglock_release();
 		return ENAMETOOLONG;
 	}
 	strcpy(buf, path);
@@ -541,7 +670,6 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 	VOP_INCREF(&sv->sv_absvn);
 	*ret = &sv->sv_absvn;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -559,22 +687,19 @@ sfs_lookup(struct vnode *v, char *path, struct vnode **ret)
 	struct sfs_vnode *final;
 	int result;
 
-	vfs_biglock_acquire();
-
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return ENOTDIR;
 	}
 
+	lock_acquire(sv->sv_lock);
 	result = sfs_lookonce(sv, path, &final, NULL);
+	lock_release(sv->sv_lock);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	*ret = &final->sv_absvn;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -47,6 +47,19 @@ int sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock);
 void sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock);
 int sfs_bused(struct sfs_fs *sfs, daddr_t diskblock);
 
+/* Functions in sfs_buf.c */
+struct sfs_buf;
+int sfs_buf_init(void);
+int sfs_buf_read(struct sfs_fs *sfs, daddr_t block, struct sfs_buf **ret);
+int sfs_buf_get(struct sfs_fs *sfs, daddr_t block, struct sfs_buf **ret);
+void *sfs_buf_data(struct sfs_buf *b);
+bool sfs_buf_valid(struct sfs_buf *b);
+void sfs_buf_dirty(struct sfs_buf *b);
+void sfs_buf_release(struct sfs_buf *b);
+void sfs_buf_forget(struct sfs_fs *sfs, daddr_t block);
+int sfs_buf_sync(struct sfs_fs *sfs);
+void sfs_buf_unmount(struct sfs_fs *sfs);
+
 /* Functions in sfs_bmap.c */
 int sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		daddr_t *diskblock);
@@ -35,11 +35,39 @@
  */
 
 
+#include <array.h>
+#include <spinlock.h>
 #include <vm.h>
+#include <platform/maxcpus.h>
 #include "opt-dumbvm.h"
 
 struct vnode;
 
+struct region {
+        vaddr_t base_addr;      /* Base of a region */
+        size_t r_size;          /* Size of the entire region */
+        uint32_t read;
+        uint32_t write;
+        uint32_t exec;
+        uint32_t ker_write;     /* Kernel write permission */
+        struct vnode *r_vnode;  /* File the contents come from, or NULL */
+        vaddr_t r_fvaddr;       /* Where the file data starts */
+        off_t r_foffset;        /* Offset of that data in the file */
+        size_t r_filesize;      /* Bytes of file data; the rest is zero */
+        uint32_t r_shared;      /* Mapped file, shared through the page cache;
+                                   read to the file's end, not r_filesize */
+};
+
+/*
+ * Array of regions, kept sorted by base address.
+ */
+#ifndef ADDRSPACEINLINE
+#define ADDRSPACEINLINE INLINE
+#endif
+
+DECLARRAY(region, ADDRSPACEINLINE);
+DEFARRAY(region, ADDRSPACEINLINE);
+
 
 /*
  * Address space - data structure associated with the virtual memory
@@ -60,21 +88,22 @@ struct addrspace {
 #else
         /* Put stuff here for your VM system */
 
-        paddr_t **page_table;   /* Page table for each virtual address space */
-        struct region *head;    /* Keep linked list of regions in address space - per process*/                  
+        paddr_t **page_table;   /* Level one directory, NULL until more than PT_INLINE level two tables */
+        paddr_t *pt_inline[PT_INLINE];          /* Level two tables while there is no directory... */
+        uint16_t pt_inline_slot[PT_INLINE];     /* ...and the level one slots they cover */
+        unsigned pt_ninline;
+        uint32_t pt_used[PG_TABLE_ONE / 32];   /* Bitmap of level one slots with a level two table */
+        struct regionarray regions;     /* Regions in address space sorted by base - per process */
+        struct region *last_region;     /* Region the last lookup found */
+        struct spinlock pt_lock;        /* Page table entries, against the swapper */
+        uint32_t as_asid[MAXCPUS];      /* ASID and generation on each cpu (see tlb.c) */
+        struct region *as_heap;         /* sbrk region, once the program is loaded */
+        vaddr_t as_heapend;             /* Current break; the region is this rounded up */
+        struct region *as_stack;        /* Stack region, grown downwards on demand */
+        size_t as_stackmax;             /* Size the stack may grow to */
 #endif
 };
 
-struct region {
-        vaddr_t base_addr;      /* Base of a region */
-        size_t r_size;          /* Size of the entire region */
-        uint32_t read;
-        uint32_t write;
-        uint32_t exec;
-        uint32_t ker_write;     /* Kernel write permission */
-        struct region *next;    /* Location of next region */
-};
-
 /*
  * Functions in addrspace.c:
  *
@@ -102,6 +131,9 @@ struct region {
  *    as_define_region - set up a region of memory within the address
  *                space.
  *
+ *    as_define_file - back part of a region with a file, to be read
+ *                in a page at a time as it is first touched.
+ *
  *    as_prepare_load - this is called before actually loading from an
  *                executable into the address space.
  *
@@ -112,6 +144,25 @@ struct region {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_growstack - extend the stack region down to cover VADDR, if
+ *                that is within the stack's limit. Returns EFAULT if
+ *                it isn't.
+ *
+ *    as_setstackmax - set the limit, in pages, that the stacks of
+ *                address spaces set up from now on may grow to.
+ *
+ *    as_mmap   - map LEN bytes of file V from OFFSET, shared, at an
+ *                address of our choosing below the stack. Writes go
+ *                back to the file on as_munmap, fsync, or exit.
+ *
+ *    as_munmap - remove the mapping starting at ADDR and write back
+ *                its dirty pages.
+ *
+ *    as_sbrk   - move the end of the heap by AMOUNT bytes, handing
+ *                back the old end. Growing only reserves address
+ *                space; shrinking unmaps and frees the pages past the
+ *                new end.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -127,9 +178,54 @@ int               as_define_region(struct addrspace *as,
                                    int readable,
                                    int writeable,
                                    int executable);
+int               as_define_file(struct addrspace *as, vaddr_t vaddr,
+                                 struct vnode *v, off_t offset,
+                                 size_t filesize);
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_growstack(struct addrspace *as, vaddr_t vaddr);
+int               as_setstackmax(unsigned npages);
+unsigned          as_getstackmax(void);
+int               as_mmap(struct addrspace *as, struct vnode *v,
+                          size_t len, int prot, off_t offset,
+                          vaddr_t *addr);
+int               as_munmap(struct addrspace *as, vaddr_t addr);
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldbreak);
+
+/* mmap protection, as in userland <unistd.h> */
+#define PROT_READ  1
+#define PROT_WRITE 2
+
+/*
+ * Functions in vm.c:
+ *
+ *    lookup_pte - return a pointer to the page table entry for a
+ *                 virtual address, or NULL if no level two table
+ *                 covers it yet.
+ *
+ *    pt_table  - return the level two table for a level one slot, or
+ *                 NULL if there isn't one.
+ *
+ *    pt_addtable - hook a level two table (from ptpool_get) into a
+ *                 level one slot, taking a page for the directory if
+ *                 the inline slots are full. The table is given back
+ *                 to the pool if the slot turns out to have one
+ *                 already, or on ENOMEM.
+ *
+ *    region_lookup - find the region containing a virtual address and
+ *                 check it permits an access of the given fault type.
+ *                 Returns EFAULT if there is no such region and EPERM
+ *                 if the access isn't allowed.
+ */
+
+paddr_t          *lookup_pte(struct addrspace *as, vaddr_t vaddr);
+paddr_t          *pt_table(struct addrspace *as, uint32_t slot);
+int               pt_addtable(struct addrspace *as, uint32_t slot,
+                              paddr_t *table);
+int               region_lookup(struct addrspace *as, vaddr_t vaddr,
+                                int faulttype, struct region **ret);
 
 
 /*
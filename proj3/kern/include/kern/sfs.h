@@ -86,7 +86,8 @@ struct sfs_dinode {
 	uint16_t sfi_linkcount;			/* # hard links to this file */
 	uint32_t sfi_direct[SFS_NDIRECT];	/* Direct blocks */
 	uint32_t sfi_indirect;			/* Indirect block */
-	uint32_t sfi_waste[128-3-SFS_NDIRECT];	/* unused space, set to 0 */
+	uint32_t sfi_dirhash;			/* # hash buckets (dirs only) */
+	uint32_t sfi_waste[128-4-SFS_NDIRECT];	/* unused space, set to 0 */
 };
 
 /*
@@ -97,5 +98,29 @@ struct sfs_direntry {
 	char sfd_name[SFS_NAMELEN];		/* Filename */
 };
 
+/*
+ * Hashed directories.
+ *
+ * A directory whose sfi_dirhash is 0 is a plain array of entries that
+ * has to be searched from one end to the other. Otherwise it is exactly
+ * sfi_dirhash blocks long and each block is a hash bucket. An entry goes
+ * in the block SFS_DIRHASH(name) % sfi_dirhash, or if that's full, in the
+ * first block after it (wrapping around) that isn't; so every block from
+ * an entry's home bucket up to the one it's in is full, and a search can
+ * stop at the first block with a free slot. Buckets nobody has used yet
+ * need not be allocated.
+ *
+ * The entries themselves are ordinary struct sfs_direntry, so anything
+ * that just reads a directory through doesn't need to care.
+ *
+ * The hash is 32-bit FNV-1a over the bytes of the name:
+ *	h = SFS_DIRHASH_BASIS; for each byte c: h = (h ^ c) * SFS_DIRHASH_PRIME
+ */
+#define SFS_DIRHASH_BASIS   2166136261U
+#define SFS_DIRHASH_PRIME   16777619U
+#define SFS_DIRHASH_MAXBUCKETS (SFS_NDIRECT + SFS_DBPERIDB)
+/* Buckets mksfs gives the root: all it can have, as unused ones are free */
+#define SFS_DIRHASH_NBUCKETS SFS_DIRHASH_MAXBUCKETS
+
 
 #endif /* _KERN_SFS_H_ */
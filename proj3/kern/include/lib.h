@@ -125,6 +125,9 @@ uint32_t random(void);
  *
  * kheap_nextgeneration, dump, and dumpall do nothing unless heap
  * labeling (for leak detection) in kmalloc.c (q.v.) is enabled.
+ *
+ * kheap_shrink gives back up to NPAGES pages the heap is holding on to
+ * but not using, and returns how many it freed.
  */
 void *kmalloc(size_t size);
 void kfree(void *ptr);
@@ -132,6 +135,7 @@ void kheap_printstats(void);
 void kheap_nextgeneration(void);
 void kheap_dump(void);
 void kheap_dumpall(void);
+unsigned kheap_shrink(unsigned npages);
 
 /*
  * C string functions.
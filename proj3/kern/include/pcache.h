@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PCACHE_H_
+#define _PCACHE_H_
+
+/*
+ * Page cache for shared file pages.
+ *
+ * Pages of read-only, executable regions are read from the executable
+ * once and then shared, by frame reference count, between every
+ * address space running that program. Pages of files mapped with mmap
+ * are shared the same way, writeable, so every process mapping a file
+ * sees the others' writes; those pages are marked dirty when first
+ * written and written back to the file by pcache_writeback.
+ *
+ * The cache is keyed by vnode and page-aligned file offset and holds
+ * one reference on each frame. A clean frame nobody maps any more is
+ * given back by the cache's shrinker, and all of a file's pages are
+ * written back if need be and dropped when its vnode is reclaimed.
+ *
+ * The file itself is still read and written directly, so the system
+ * calls keep the two in step: read() writes back dirty pages in its
+ * range first, write() copies what it wrote into any cached pages, and
+ * truncating the file drops or zeroes the cached pages past its end.
+ *
+ * Functions:
+ *
+ *    pcache_bootstrap - register the shrinker; called from vm_bootstrap.
+ *
+ *    pcache_lookup - return the cached frame for (V, OFFSET), with a
+ *                    reference added for the caller, or 0 if there
+ *                    isn't one.
+ *
+ *    pcache_insert - cache the newly filled FRAME for (V, OFFSET).
+ *                    Returns the frame the caller should map: FRAME
+ *                    itself, or the frame someone else cached first,
+ *                    in which case FRAME has been freed. Either way
+ *                    the caller holds one reference on it. Returns 0,
+ *                    leaving FRAME alone, if out of memory.
+ *
+ *    pcache_setdirty - note the page at (V, OFFSET) has been written.
+ *
+ *    pcache_writeback - write the dirty pages of V from START up to
+ *                    END back to the file. A page stays dirty if an
+ *                    address space still maps it.
+ *
+ *    pcache_update - copy the file's contents from START up to END
+ *                    into any cached pages there; called after a write.
+ *
+ *    pcache_truncate - V is now LEN bytes long: drop the cached pages
+ *                    past that nobody maps, and zero the rest of the
+ *                    cached data past it.
+ *
+ *    pcache_purge  - write back and drop every page of V; called as
+ *                    its vnode goes.
+ */
+
+struct vnode;
+
+void pcache_bootstrap(void);
+paddr_t pcache_lookup(struct vnode *v, off_t offset);
+paddr_t pcache_insert(struct vnode *v, off_t offset, paddr_t frame);
+void pcache_setdirty(struct vnode *v, off_t offset);
+int pcache_writeback(struct vnode *v, off_t start, off_t end);
+int pcache_update(struct vnode *v, off_t start, off_t end);
+void pcache_truncate(struct vnode *v, off_t len);
+void pcache_purge(struct vnode *v);
+
+/* Print the hit rate and number of cached and dirty pages */
+void pcache_printstats(void);
+
+#endif /* _PCACHE_H_ */
@@ -59,10 +59,11 @@ void pid_unalloc(pid_t targetpid);
 void pid_disown(pid_t targetpid);
 
 /*
- * Set the exit status of the current thread to status.  Wakes up any threads
- * waiting to read this status, and decrefs the current thread's pid.
+ * Set the exit status of process PID, which has exited and been
+ * destroyed, to status. Wakes up any threads waiting to read this
+ * status, and decrefs the pid.
  */
-void pid_setexitstatus(int status);
+void pid_setexitstatus(pid_t pid, int status);
 
 /*
  * Causes the current thread to wait for the thread with pid PID to
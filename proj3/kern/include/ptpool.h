@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PTPOOL_H_
+#define _PTPOOL_H_
+
+/*
+ * Pool of empty page table pages.
+ *
+ * Level two page tables, and the level one directory of an address
+ * space big enough to need one, are each exactly one page. They come
+ * from here rather than from kmalloc, so they are page aligned and
+ * never share a page with anything else. Pages handed back are zeroed
+ * (every entry NO_ENTRY, every directory slot NULL) and kept for the
+ * next fork or fault, up to a limit; a shrinker gives them up when
+ * memory is short.
+ *
+ * Functions:
+ *
+ *    ptpool_bootstrap - register the shrinker.
+ *
+ *    ptpool_get - take an empty page table page, or NULL if there is
+ *                 no memory. May sleep, so don't hold pt_lock.
+ *
+ *    ptpool_put - give back a page from ptpool_get, whatever it holds.
+ */
+
+void ptpool_bootstrap(void);
+void *ptpool_get(void);
+void ptpool_put(void *page);
+
+/* Print how many pages are pooled and how often the pool was hit */
+void ptpool_printstats(void);
+
+#endif /* _PTPOOL_H_ */
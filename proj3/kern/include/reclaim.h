@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _RECLAIM_H_
+#define _RECLAIM_H_
+
+/*
+ * Memory reclaim.
+ *
+ * Subsystems holding memory they can give back (caches, or user pages
+ * that can go out to swap) register a shrinker. When the number of
+ * free frames falls below the low watermark the reclaim thread is
+ * woken, and calls the shrinkers until it is back above the high
+ * watermark. An allocation that fails outright calls them directly
+ * (synchronous reclaim) and then tries again, provided the caller is
+ * in a context that can sleep.
+ *
+ * Shrinkers are called in the order they were registered, so cheap
+ * ones should register first. sh_shrink should try to free NFRAMES
+ * frames and return how many it did free. It may sleep, but must not
+ * wait for anything that could itself be waiting for memory.
+ *
+ * Functions:
+ *
+ *    reclaim_bootstrap - pick default watermarks and start the thread.
+ *    reclaim_register  - add a shrinker. It can't be removed again.
+ *    reclaim_poke      - tell reclaim how many frames are free; wakes
+ *                        the thread if that's below the low watermark.
+ *    reclaim_sync      - run the shrinkers now for NFRAMES frames, if
+ *                        it is safe to sleep. Returns frames freed.
+ *    reclaim_setwatermarks - change the watermarks.
+ *    reclaim_lowwater  - the low watermark, for callers that only want
+ *                        memory that is going spare.
+ *    reclaim_dropcaches - run every shrinker except those that page
+ *                        out (sh_evicts) until none of them can free
+ *                        any more. For measuring memory use. Returns
+ *                        frames freed.
+ */
+
+struct shrinker {
+	const char *sh_name;
+	unsigned (*sh_shrink)(unsigned nframes);
+	bool sh_evicts;			/* frees by paging out, not a cache */
+
+	/* Statistics, maintained by reclaim */
+	uint32_t sh_calls;
+	uint32_t sh_freed;
+};
+
+void reclaim_bootstrap(void);
+void reclaim_register(struct shrinker *sh);
+void reclaim_poke(unsigned nfree);
+unsigned reclaim_sync(unsigned nframes);
+int reclaim_setwatermarks(unsigned low, unsigned high);
+unsigned reclaim_lowwater(void);
+unsigned reclaim_dropcaches(void);
+
+/* Print the watermarks and how much each shrinker has freed */
+void reclaim_printstats(void);
+
+#endif /* _RECLAIM_H_ */
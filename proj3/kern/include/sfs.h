@@ -48,18 +48,34 @@
  */
 #include <kern/sfs.h>
 
+struct lock;
+
 /*
  * In-memory inode
+ *
+ * sv_lock protects sv_i, sv_dirty and the contents of the file (its
+ * data and indirect blocks). The inode type never changes once the
+ * vnode is loaded, so it can be looked at without the lock.
  */
 struct sfs_vnode {
 	struct vnode sv_absvn;          /* abstract vnode structure */
 	struct sfs_dinode sv_i;		/* copy of on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	struct lock *sv_lock;           /* see above */
+	struct sfs_vnode *sv_hashnext;  /* chain in sfs_vnhash */
+	unsigned sv_index;              /* slot in sfs_vnodes */
 };
 
+/* Number of chains in the per-volume table of loaded vnodes */
+#define SFS_VNHASH 256
+
 /*
  * In-memory info for a whole fs volume
+ *
+ * Lock ordering: a directory's sv_lock before that of a file in it,
+ * any sv_lock before sfs_vnlock, and sfs_vnlock before
+ * sfs_freemaplock. The buffer cache has its own lock, taken last.
  */
 struct sfs_fs {
 	struct fs sfs_absfs;            /* abstract filesystem structure */
@@ -67,8 +83,11 @@ struct sfs_fs {
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
 	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct sfs_vnode *sfs_vnhash[SFS_VNHASH]; /* same, by inode number */
+	struct lock *sfs_vnlock;        /* protects sfs_vnodes, sfs_vnhash */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	struct lock *sfs_freemaplock;   /* protects the freemap */
 };
 
 /*
@@ -76,5 +95,11 @@ struct sfs_fs {
  */
 int sfs_mount(const char *device);
 
+/*
+ * Print buffer cache hit rates (in sfs_buf.c); RESET starts the
+ * counts over.
+ */
+void sfs_buf_printstats(bool reset);
+
 
 #endif /* _SFS_H_ */
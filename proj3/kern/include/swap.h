@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space.
+ *
+ * Pages are evicted to fixed page-sized slots on a raw disk device
+ * attached with swap_on. A swapped out page's entry in the page table
+ * holds its slot number (see PTE_SWAPPED in vm.h). A slot is shared
+ * by every address space that forked from the one that swapped it out,
+ * so slots are reference counted just like frames.
+ *
+ * Functions:
+ *
+ *    swap_bootstrap - set up the locks; called from vm_bootstrap.
+ *
+ *    swap_on      - start swapping to the raw device DEVNAME.
+ *
+ *    swap_evict   - pick a frame with the clock algorithm, write it out
+ *                   and free it. Returns ENOMEM if nothing could be
+ *                   evicted, including when swap isn't turned on.
+ *
+ *    swap_pagein  - bring the page at VADDR of AS back in from swap,
+ *                   into the newly allocated FRAME.
+ *
+ *    swap_dup     - add a reference to a slot, for fork.
+ *    swap_free    - drop a reference to a slot.
+ *
+ *    swap_lock_acquire/swap_lock_release - hold off eviction, for
+ *                   tearing down or copying an address space the
+ *                   clock hand may be looking at. Nothing can be
+ *                   evicted meanwhile, so allocate memory first.
+ */
+
+struct addrspace;
+
+#define PTE_TO_SLOT(pte)   ((pte) >> 12)
+#define SLOT_TO_PTE(slot)  (((paddr_t)(slot) << 12) | PTE_SWAPPED)
+
+void swap_bootstrap(void);
+int swap_on(const char *devname);
+int swap_evict(void);
+int swap_pagein(struct addrspace *as, vaddr_t vaddr, paddr_t frame);
+void swap_dup(unsigned slot);
+void swap_free(unsigned slot);
+void swap_lock_acquire(void);
+void swap_lock_release(void);
+
+/* Print slot usage and page in/out counts */
+void swap_printstats(void);
+
+#endif /* _SWAP_H_ */
@@ -70,6 +70,7 @@ int sys_execv(userptr_t prog, userptr_t args);
 __DEAD void sys__exit(int code);
 int sys_waitpid(pid_t pid, userptr_t returncode, int flags, pid_t *retval);
 int sys_getpid(pid_t *retval);
+int sys_sbrk(intptr_t amount, int32_t *retval);
 
 int sys_open(const_userptr_t filename, int flags, mode_t mode, int *retval);
 int sys_dup2(int oldfd, int newfd, int *retval);
@@ -91,5 +92,7 @@ int sys_getdirentry(int fd, userptr_t buf, size_t buflen, int *retval);
 int sys_fstat(int fd, userptr_t statptr);
 int sys_fsync(int fd);
 int sys_ftruncate(int fd, off_t len);
+int sys_mmap(size_t len, int prot, int fd, off_t offset, int32_t *retval);
+int sys_munmap(userptr_t addr);
 
 #endif /* _SYSCALL_H_ */
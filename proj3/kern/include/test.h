@@ -98,6 +98,10 @@ int kmalloctest3(int, char **);
 int kmalloctest4(int, char **);
 int nettest(int, char **);
 
+/* vm tests */
+int frametest(int, char **);
+int regiontest(int, char **);
+
 /* Routine for running a user-level program. */
 int runprogram(char *progname);
 
@@ -82,6 +82,7 @@ struct thread {
 	void *t_stack;			/* Kernel-level stack */
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
+	bool t_bound;			/* Never migrated off t_cpu */
 	struct proc *t_proc;		/* Process thread belongs to */
 	HANGMAN_ACTOR(t_hangman);	/* Deadlock detector hook */
 
@@ -107,6 +108,7 @@ struct thread {
 	 */
 
 	/* add more here as needed */
+	bool t_reclaiming;		/* Running shrinkers (see reclaim.h) */
 };
 
 /*
@@ -145,6 +147,17 @@ int thread_fork(const char *name, struct proc *proc,
                 void (*func)(void *, unsigned long),
                 void *data1, unsigned long data2);
 
+/*
+ * Like thread_fork, but the new thread runs on the cpu numbered
+ * "cpunum" and stays there; the scheduler never migrates it. For
+ * per-cpu kernel threads. thread_ncpus gives the number of cpus,
+ * which are numbered from 0.
+ */
+int thread_fork_bound(const char *name, struct proc *proc, unsigned cpunum,
+                      void (*func)(void *, unsigned long),
+                      void *data1, unsigned long data2);
+unsigned thread_ncpus(void);
+
 /*
  * Cause the current thread to exit.
  * Interrupts need not be disabled.
@@ -158,6 +171,12 @@ __DEAD void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Count threads that have exited but whose stacks haven't been freed
+ * yet; that happens when their cpu next switches threads.
+ */
+unsigned thread_nzombies(void);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
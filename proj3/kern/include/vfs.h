@@ -81,6 +81,36 @@ int vfs_lookup(char *path, struct vnode **result);
 int vfs_lookparent(char *path, struct vnode **result,
 		   char *buf, size_t buflen);
 
+/*
+ * Name cache (vfsdcache.c), used by vfs_lookup and vfs_lookparent.
+ *
+ *    vfs_dcache_lookup   - Look up NAME in DIR. Returns true if the
+ *                          answer is cached: *RESULT is a new reference
+ *                          to the vnode, or NULL if there's no such
+ *                          name. Sets *GEN either way.
+ *    vfs_dcache_enter    - Cache what VOP_LOOKUP of NAME in DIR found:
+ *                          VN, or NULL for ENOENT. GEN is from the
+ *                          vfs_dcache_lookup that missed; if anything
+ *                          was invalidated since, nothing is cached.
+ *    vfs_dcache_forget   - Forget NAME in DIR. Call after an operation
+ *                          that might have changed what NAME is.
+ *    vfs_dcache_purgevnode - Forget everything in or naming VN.
+ *    vfs_dcache_purgefs  - Forget everything on FS (before unmount).
+ *    vfs_dcache_purgeall - Forget everything.
+ *    vfs_dcache_printstats - Print hit rates; RESET starts them over.
+ */
+
+void vfs_dcache_bootstrap(void);
+bool vfs_dcache_lookup(struct vnode *dir, const char *name,
+		       struct vnode **result, unsigned *gen);
+void vfs_dcache_enter(struct vnode *dir, const char *name, struct vnode *vn,
+		      unsigned gen);
+void vfs_dcache_forget(struct vnode *dir, const char *name);
+void vfs_dcache_purgevnode(struct vnode *vn);
+void vfs_dcache_purgefs(struct fs *fs);
+void vfs_dcache_purgeall(void);
+void vfs_dcache_printstats(bool reset);
+
 /*
  * VFS layer high-level operations on pathnames
  * Because lookup may destroy pathnames, these all may too.
@@ -35,13 +35,43 @@
  *
  * You'll probably want to add stuff here.
  */
-#define STACK_PAGES 16
-#define PG_TABLE_ONE 2048
-#define PG_TABLE_TWO 512
+#define STACK_INITPAGES  4      /* Stack region a process starts with */
+#define STACK_MAXPAGES   1024   /* Default limit the stack may grow to */
+#define STACK_GUARDPAGES 16     /* Gap kept clear below the stack's limit */
+#define PG_TABLE_ONE 1024      /* Level one slots, 4 MiB of address space each */
+#define PG_TABLE_TWO 1024      /* Entries in a level two table, which is one page */
+#define PT_INLINE 4            /* Level two tables an address space holds without a directory */
 #define NO_ENTRY 0x00000000        /* Using the unused region of pt entry to indicate this entry is empty */
 
 #include <machine/vm.h>
 
+struct addrspace;
+
+/*
+ * Software bits in a page table entry. Everything else in an entry is
+ * laid out like TLB EntryLo; these bits are masked off before an entry
+ * is loaded into the TLB.
+ *
+ * PTE_WRITEABLE caches whether the page's region may be written, so a
+ * fault on a page with an entry never needs to find its region. An
+ * entry without TLBLO_DIRTY but with PTE_WRITEABLE is copy-on-write,
+ * unless it also has PTE_SHARED: then it is a page of a mapped file,
+ * shared through the page cache, which is written in place.
+ *
+ * A swapped out page's entry has PTE_SWAPPED set and its swap slot
+ * number in place of the frame number. TLBLO_DIRTY and PTE_WRITEABLE
+ * are kept as they were.
+ *
+ * PTE_LPAGE marks a page that was filled as part of a large page: an
+ * aligned run of LPAGE_PAGES physically contiguous frames. A TLB miss
+ * on one of them loads the whole run's resident pages at once.
+ */
+#define PTE_SWAPPED   0x00000001
+#define PTE_WRITEABLE 0x00000002
+#define PTE_SHARED    0x00000004
+#define PTE_LPAGE     0x00000008
+#define PTE_SOFT_MASK 0x000000ff
+
 /* Fault-type arguments to vm_fault() */
 #define VM_FAULT_READ        0    /* A read was attempted */
 #define VM_FAULT_WRITE       1    /* A write was attempted */
@@ -54,16 +84,62 @@ void vm_bootstrap(void);
 /* Fault handling function called by trap code */
 int vm_fault(int faulttype, vaddr_t faultaddress);
 
+/* Fault-around: pages mapped after each faulting page (0 is off) */
+#define FAULTAROUND_DEFAULT  4
+#define FAULTAROUND_MAX      16
+int vm_setfaultaround(unsigned npages);
+unsigned vm_getfaultaround(void);
+uint32_t vm_nfaults(void);
+
+/* Large pages: pages per run backing big anonymous regions */
+#define LPAGE_PAGES          16
+
 /* Allocate/free kernel heap pages (called by kmalloc/kfree) */
 vaddr_t alloc_kpages(unsigned npages);
 void free_kpages(vaddr_t addr);
 
+/* Print frame allocator statistics (fragmentation, failures) */
+void frame_printstats(void);
+
+/* Number of free frames */
+unsigned frame_nfree(void);
+
+/* Reference counts on user frames shared copy-on-write */
+void frame_incref(paddr_t paddr);
+void frame_decref(paddr_t paddr);
+unsigned frame_getref(paddr_t paddr);
+void frame_decref_batch(const paddr_t *frames, unsigned nframes);
+
+/* Contiguous run of single user frames for a large page (0 if none) */
+paddr_t frame_alloc_run(unsigned npages);
+
+/* Reverse mapping and clock replacement for evicting user frames */
+void frame_set_owner(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+void frame_reference(paddr_t paddr);
+paddr_t frame_pick_victim(struct addrspace **as, vaddr_t *vaddr);
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
 /* Helpers for tlb stuff */
 uint32_t get_level_one(vaddr_t vaddrs);
 uint32_t get_level_two(vaddr_t vaddrs);
+
+/* TLB management, with ASIDs and a software TLB (tlb.c) */
+void tlb_activate(struct addrspace *as);
+void tlb_forget(struct addrspace *as);
+void tlb_forget_remote(struct addrspace *as);
 void tlb_refill(uint32_t entryhi, uint32_t entrylo);
+void tlb_update(uint32_t entryhi, uint32_t entrylo);
+int tlb_reload(vaddr_t vaddr, int write);
+void tlb_invalidate(struct addrspace *as, vaddr_t vaddr);
+void tlb_flush(void);
+int tlb_setpolicy(const char *name);
+const char *tlb_policyname(int n);
+uint32_t tlb_nloads(void);
+void tlb_printstats(void);
+
+/* Print VM statistics (free frames, swap usage) */
+void vm_printstats(void);
 
 #endif /* _VM_H_ */
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _ZEROPOOL_H_
+#define _ZEROPOOL_H_
+
+/*
+ * Pool of pre-zeroed frames.
+ *
+ * First touches of anonymous memory take an already zeroed frame from
+ * here rather than zeroing one on the spot. The pool is topped up by
+ * "zeropool" threads, one bound to each cpu, which only run when their
+ * cpu has nothing else to do: thread_switch calls zeropool_idle instead
+ * of going idle, and that wakes the cpu's thread if the pool is low.
+ * It zeroes a few frames and goes back to sleep, so the cpu can idle
+ * (or pick up real work) again.
+ *
+ * Functions:
+ *
+ *    zeropool_bootstrap - start the threads and register a shrinker to
+ *                         give the pool back when memory is short.
+ *
+ *    zeropool_get  - take a zeroed frame, or 0 if the pool is empty.
+ *
+ *    zeropool_idle - called by thread_switch in place of cpu_idle,
+ *                    with interrupts off. Returns true if it woke this
+ *                    cpu's thread, in which case there is something to
+ *                    run and the caller shouldn't idle.
+ *
+ *    zeropool_npooled - number of frames in the pool right now.
+ */
+
+void zeropool_bootstrap(void);
+paddr_t zeropool_get(void);
+bool zeropool_idle(void);
+unsigned zeropool_npooled(void);
+
+/* Print the pool level and hit rate */
+void zeropool_printstats(void);
+
+#endif /* _ZEROPOOL_H_ */
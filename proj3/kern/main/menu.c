@@ -45,8 +45,15 @@
 #include <pid.h>
 #include <syscall.h>
 #include <test.h>
+#include <vm.h>
+#include <addrspace.h>
+#include <swap.h>
+#include <reclaim.h>
+#include <zeropool.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-unsw.h"
+#include "opt-dumbvm.h"
 
 /*
  * In-kernel menu and command dispatcher.
@@ -166,6 +173,271 @@ cmd_prog(int nargs, char **args)
 	return common_prog(nargs, args);
 }
 
+#if OPT_UNSW
+/*
+ * Count free frames for the leak check. First empty everything that
+ * holds frames for reuse rather than for a user: the name cache (and
+ * with it the vnodes it pins), then every cache shrinker. Frames in
+ * the per-cpu magazines are already free as far as frame_nfree is
+ * concerned; frames the zeroing threads put back in the pool, and the
+ * stacks of exited threads not yet freed, are counted here.
+ *
+ * An exiting thread on another cpu may still be between waking us and
+ * becoming a zombie, so take samples until two in a row agree.
+ */
+static
+unsigned
+leakcheck_nfree(void)
+{
+	unsigned prev, n, tries;
+
+	n = (unsigned)-1;
+	for (tries = 0; tries < 10; tries++) {
+		prev = n;
+		vfs_dcache_purgeall();
+		reclaim_dropcaches();
+		n = frame_nfree();
+#if !OPT_DUMBVM
+		n += zeropool_npooled();
+#endif
+		n += thread_nzombies() * DIVROUNDUP(STACK_SIZE, PAGE_SIZE);
+		if (n == prev) {
+			break;
+		}
+		thread_yield();
+	}
+	return n;
+}
+
+/*
+ * Command for running a program and checking that every frame it
+ * used has been returned to the frame allocator once it exits.
+ */
+static
+int
+cmd_leakcheck(int nargs, char **args)
+{
+	unsigned before, after;
+	int result;
+
+	if (nargs < 2) {
+		kprintf("Usage: lc program [arguments]\n");
+		return EINVAL;
+	}
+
+	/* drop the leading "lc" */
+	args++;
+	nargs--;
+
+	before = leakcheck_nfree();
+
+	/* Returns once the child's process has been destroyed */
+	result = common_prog(nargs, args);
+	if (result) {
+		return result;
+	}
+
+	after = leakcheck_nfree();
+
+	kprintf("Free frames: %u before, %u after", before, after);
+	if (after < before) {
+		kprintf(", %u leaked\n", before - after);
+	}
+	else {
+		kprintf(", no leak\n");
+	}
+	return 0;
+}
+#endif
+
+#if OPT_UNSW && !OPT_DUMBVM
+/*
+ * Command to choose the TLB replacement policy. Put it on the boot
+ * command line to run with a policy from the start.
+ */
+static
+int
+cmd_tlbpolicy(int nargs, char **args)
+{
+	const char *name;
+	int i;
+
+	if (nargs == 2) {
+		if (tlb_setpolicy(args[1])) {
+			kprintf("tlbpolicy: No policy %s\n", args[1]);
+			return EINVAL;
+		}
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: tlbpolicy [policy]\n");
+		return EINVAL;
+	}
+
+	kprintf("TLB replacement policy: %s (", tlb_policyname(-1));
+	for (i = 0; (name = tlb_policyname(i)) != NULL; i++) {
+		kprintf("%s%s", i > 0 ? ", " : "", name);
+	}
+	kprintf(")\n");
+	return 0;
+}
+
+/*
+ * Command for running a program once under each TLB replacement
+ * policy and comparing how many TLB misses each took.
+ */
+#define TLBCMP_MAX 8
+
+static
+int
+cmd_tlbcompare(int nargs, char **args)
+{
+	struct timespec before, after;
+	uint32_t loads[TLBCMP_MAX], msecs[TLBCMP_MAX];
+	const char *oldpolicy, *name;
+	uint32_t start;
+	int i, result;
+
+	if (nargs < 2) {
+		kprintf("Usage: tlbcmp program [arguments]\n");
+		return EINVAL;
+	}
+
+	/* drop the leading "tlbcmp" */
+	args++;
+	nargs--;
+
+	oldpolicy = tlb_policyname(-1);
+	for (i = 0; (name = tlb_policyname(i)) != NULL && i < TLBCMP_MAX; i++) {
+		tlb_setpolicy(name);
+		tlb_flush();
+
+		start = tlb_nloads();
+		gettime(&before);
+		result = common_prog(nargs, args);
+		gettime(&after);
+		if (result) {
+			tlb_setpolicy(oldpolicy);
+			return result;
+		}
+
+		loads[i] = tlb_nloads() - start;
+		timespec_sub(&after, &before, &after);
+		msecs[i] = after.tv_sec * 1000 + after.tv_nsec / 1000000;
+	}
+	tlb_setpolicy(oldpolicy);
+
+	for (i = 0; (name = tlb_policyname(i)) != NULL && i < TLBCMP_MAX; i++) {
+		kprintf("%-6s %8u TLB misses in %6u ms", name, loads[i],
+			msecs[i]);
+		if (msecs[i] > 0) {
+			kprintf(", %u per ms", loads[i] / msecs[i]);
+		}
+		kprintf("\n");
+	}
+	return 0;
+}
+
+/*
+ * Command to set how many pages after a fault are mapped along with
+ * the faulting one.
+ */
+static
+int
+cmd_faultaround(int nargs, char **args)
+{
+	if (nargs == 2) {
+		if (vm_setfaultaround(atoi(args[1]))) {
+			kprintf("faultaround: At most %u pages\n",
+				FAULTAROUND_MAX);
+			return EINVAL;
+		}
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: faultaround [pages]\n");
+		return EINVAL;
+	}
+
+	kprintf("Fault-around: %u pages\n", vm_getfaultaround());
+	return 0;
+}
+
+/*
+ * Command to set how far the stacks of programs started from now on
+ * may grow.
+ */
+static
+int
+cmd_stackmax(int nargs, char **args)
+{
+	if (nargs == 2) {
+		if (as_setstackmax(atoi(args[1]))) {
+			kprintf("stackmax: Must be from %u to %u pages\n",
+				STACK_INITPAGES, (USERSTACK / 2) / PAGE_SIZE);
+			return EINVAL;
+		}
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: stackmax [pages]\n");
+		return EINVAL;
+	}
+
+	kprintf("Stack limit: %u pages\n", as_getstackmax());
+	return 0;
+}
+
+/*
+ * Command for running a program with and without fault-around and
+ * comparing the number of faults it took. Uses the current setting,
+ * or the default if fault-around is off.
+ */
+static
+int
+cmd_facompare(int nargs, char **args)
+{
+	struct timespec before, after;
+	uint32_t faults[2], msecs[2], start;
+	unsigned setting[2], old;
+	int i, result;
+
+	if (nargs < 2) {
+		kprintf("Usage: facmp program [arguments]\n");
+		return EINVAL;
+	}
+
+	/* drop the leading "facmp" */
+	args++;
+	nargs--;
+
+	old = vm_getfaultaround();
+	setting[0] = 0;
+	setting[1] = old > 0 ? old : FAULTAROUND_DEFAULT;
+	for (i = 0; i < 2; i++) {
+		vm_setfaultaround(setting[i]);
+		tlb_flush();
+
+		start = vm_nfaults();
+		gettime(&before);
+		result = common_prog(nargs, args);
+		gettime(&after);
+		if (result) {
+			vm_setfaultaround(old);
+			return result;
+		}
+
+		faults[i] = vm_nfaults() - start;
+		timespec_sub(&after, &before, &after);
+		msecs[i] = after.tv_sec * 1000 + after.tv_nsec / 1000000;
+	}
+	vm_setfaultaround(old);
+
+	for (i = 0; i < 2; i++) {
+		kprintf("fault-around %2u: %8u faults in %6u ms\n",
+			setting[i], faults[i], msecs[i]);
+	}
+	return 0;
+}
+#endif
+
 /*
  * Command for starting the system shell.
  */
@@ -459,6 +731,120 @@ cmd_bootfs(int nargs, char **args)
 	return vfs_setbootfs(device);
 }
 
+#if OPT_UNSW && !OPT_DUMBVM
+/*
+ * Command to start swapping to a disk. The default is "lhd0".
+ */
+static
+int
+cmd_swapon(int nargs, char **args)
+{
+	char *device;
+
+	if (nargs > 2) {
+		kprintf("Usage: swapon [device]\n");
+		return EINVAL;
+	}
+
+	device = nargs == 2 ? args[1] : (char *)"lhd0";
+
+	/* Allow (but do not require) colon after device name */
+	if (device[strlen(device)-1]==':') {
+		device[strlen(device)-1] = 0;
+	}
+
+	return swap_on(device);
+}
+
+static
+int
+cmd_vmstat(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vm_printstats();
+
+	return 0;
+}
+#endif
+
+#if OPT_UNSW
+/*
+ * Command to show the reclaim watermarks and statistics, or to set
+ * the watermarks.
+ */
+static
+int
+cmd_reclaim(int nargs, char **args)
+{
+	int result;
+
+	if (nargs == 3) {
+		result = reclaim_setwatermarks(atoi(args[1]), atoi(args[2]));
+		if (result) {
+			kprintf("reclaim: low must be nonzero and below high\n");
+			return result;
+		}
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: reclaim [low high]\n");
+		return EINVAL;
+	}
+
+	reclaim_printstats();
+
+	return 0;
+}
+#endif
+
+#if OPT_SFS
+/*
+ * Command to show the SFS buffer cache hit rate. With "reset" the
+ * counts start over, so a workload can be measured on its own.
+ */
+static
+int
+cmd_bufstat(int nargs, char **args)
+{
+	bool reset = false;
+
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		reset = true;
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: bufstat [reset]\n");
+		return EINVAL;
+	}
+
+	sfs_buf_printstats(reset);
+
+	return 0;
+}
+#endif
+
+/*
+ * Command to show the VFS name cache hit rate, like bufstat.
+ */
+static
+int
+cmd_dcstat(int nargs, char **args)
+{
+	bool reset = false;
+
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		reset = true;
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: dcstat [reset]\n");
+		return EINVAL;
+	}
+
+	vfs_dcache_printstats(reset);
+
+	return 0;
+}
+
 static
 int
 cmd_kheapstats(int nargs, char **args)
@@ -542,6 +928,17 @@ static const char *opsmenu[] = {
 	"[debug]   Drop to debugger          ",
 	"[panic]   Intentional panic         ",
 	"[deadlock] Intentional deadlock     ",
+#if OPT_UNSW
+	"[lc]      Leak check a program      ",
+#endif
+#if OPT_UNSW && !OPT_DUMBVM
+	"[swapon]  Start swapping to a disk  ",
+	"[tlbpolicy] Set TLB replacement     ",
+	"[tlbcmp]  Compare TLB policies      ",
+	"[faultaround] Set fault-around      ",
+	"[facmp]   Compare fault-around      ",
+	"[stackmax] Set stack size limit     ",
+#endif
 	"[q]       Quit and shut down        ",
 	NULL
 };
@@ -584,6 +981,12 @@ static const char *testmenu[] = {
 	"[fs4] FS write stress 2             ",
 	"[fs5] FS long stress                ",
 	"[fs6] FS create stress              ",
+#if OPT_UNSW
+	"[fm]  Frame allocator stats         ",
+#endif
+#if OPT_UNSW && !OPT_DUMBVM
+	"[rg]  Region lookup benchmark       ",
+#endif
 	NULL
 };
 
@@ -606,6 +1009,16 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+#if OPT_UNSW && !OPT_DUMBVM
+	"[vmstat] VM and swap stats          ",
+#endif
+#if OPT_UNSW
+	"[reclaim] Reclaim watermarks/stats  ",
+#endif
+#if OPT_SFS
+	"[bufstat] SFS buffer cache stats    ",
+#endif
+	"[dcstat] VFS name cache stats       ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -649,6 +1062,17 @@ static struct {
 	{ "debug",	cmd_debug },
 	{ "panic",	cmd_panic },
 	{ "deadlock",	cmd_deadlock },
+#if OPT_UNSW
+	{ "lc",		cmd_leakcheck },
+#endif
+#if OPT_UNSW && !OPT_DUMBVM
+	{ "swapon",	cmd_swapon },
+	{ "tlbpolicy",	cmd_tlbpolicy },
+	{ "tlbcmp",	cmd_tlbcompare },
+	{ "faultaround", cmd_faultaround },
+	{ "facmp",	cmd_facompare },
+	{ "stackmax",	cmd_stackmax },
+#endif
 	{ "q",		cmd_quit },
 	{ "exit",	cmd_quit },
 	{ "halt",	cmd_quit },
@@ -657,6 +1081,16 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+#if OPT_UNSW && !OPT_DUMBVM
+	{ "vmstat",     cmd_vmstat },
+#endif
+#if OPT_UNSW
+	{ "reclaim",    cmd_reclaim },
+#endif
+#if OPT_SFS
+	{ "bufstat",    cmd_bufstat },
+#endif
+	{ "dcstat",     cmd_dcstat },
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -716,6 +1150,14 @@ static struct {
 	{ "fs5",	longstress },
 	{ "fs6",	createstress },
 
+#if OPT_UNSW
+	/* vm tests */
+	{ "fm",		frametest },
+#endif
+#if OPT_UNSW && !OPT_DUMBVM
+	{ "rg",		regiontest },
+#endif
+
 	{ NULL, NULL }
 };
 
@@ -333,28 +333,27 @@ pid_disown(pid_t theirpid)
 }
 
 /*
- * pid_setexitstatus: Sets the exit status of this process. Must only
- * be called if the thread actually had a pid assigned. Wakes up any
- * waiters and disposes of the piddata if nobody else is still using it.
- *
- * As far as the process is concerned, this releases its pid for
- * subsequent reuse; thus we set curproc->p_pid to INVALID_PID.
+ * pid_setexitstatus: Sets the exit status of process PID. Must only
+ * be called once the process is gone: proc_exit destroys it first, so
+ * that a waiter that wakes up finds everything it owned already freed.
+ * Wakes up any waiters and disposes of the piddata if nobody else is
+ * still using it.
  */
 void
-pid_setexitstatus(int status)
+pid_setexitstatus(pid_t pid, int status)
 {
 	struct pidinfo *us;
 	int i;
 
 	lock_acquire(pidlock);
-	KASSERT(curproc->p_pid != INVALID_PID);
+	KASSERT(pid != INVALID_PID);
 
 	/* First, disown all children */
 	for (i=0; i<PROCS_MAX; i++) {
 		if (pidinfo[i]==NULL) {
 			continue;
 		}
-		if (pidinfo[i]->pi_ppid == curproc->p_pid) {
+		if (pidinfo[i]->pi_ppid == pid) {
 			pidinfo[i]->pi_ppid = INVALID_PID;
 			if (pidinfo[i]->pi_exited) {
 				pi_drop(pidinfo[i]->pi_pid);
@@ -363,7 +362,7 @@ pid_setexitstatus(int status)
 	}
 
 	/* Now, wake up our parent */
-	us = pi_get(curproc->p_pid);
+	us = pi_get(pid);
 	KASSERT(us != NULL);
 
 	us->pi_exitstatus = status;
@@ -371,13 +370,12 @@ pid_setexitstatus(int status)
 
 	if (us->pi_ppid == INVALID_PID) {
 		/* no parent */
-		pi_drop(curproc->p_pid);
+		pi_drop(pid);
 	}
 	else {
 		cv_broadcast(us->pi_cv, pidlock);
 	}
 
-	curproc->p_pid = INVALID_PID;
 	lock_release(pidlock);
 }
 
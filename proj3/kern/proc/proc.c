@@ -351,12 +351,14 @@ void
 proc_exit(int status)
 {
 	struct proc *proc = curproc;
+	pid_t pid;
 
 	/* The kernel isn't supposed to exit. */
 	KASSERT(proc != kproc);
 
-	/* Set exit status and wake up anyone waiting for us. */
-	pid_setexitstatus(status);
+	/* The pid stays taken until the exit status is set below. */
+	pid = proc->p_pid;
+	proc->p_pid = INVALID_PID;
 
 	/* Detach from the process and attach to the kernel process. */
 	KASSERT(curthread->t_proc == proc);
@@ -369,6 +371,12 @@ proc_exit(int status)
 	/* Now we can destroy the process. */
 	proc_destroy(proc);
 
+	/*
+	 * Set exit status and wake up anyone waiting for us. Only now,
+	 * so a waiter doesn't run ahead of the teardown.
+	 */
+	pid_setexitstatus(pid, status);
+
 	thread_exit();
 }
 
@@ -48,6 +48,8 @@
 #include <openfile.h>
 #include <filetable.h>
 #include <syscall.h>
+#include <pcache.h>
+#include "opt-dumbvm.h"
 
 /*
  * open() - get the path with copyinstr, then use openfile_open and
@@ -145,6 +147,16 @@ sys_readwrite(int fd, userptr_t buf, size_t size, enum uio_rw rw,
 	/* set up a uio with the buffer, its size, and the current offset */
 	uio_uinit(&iov, &useruio, buf, size, pos, rw);
 
+#if !OPT_DUMBVM
+	/* A read should see what's been stored through a mapping */
+	if (locked && rw == UIO_READ) {
+		result = pcache_writeback(file->of_vnode, pos, pos + size);
+		if (result) {
+			goto fail;
+		}
+	}
+#endif
+
 	/* do the read or write */
 	result = (rw == UIO_READ) ?
 		VOP_READ(file->of_vnode, &useruio) :
@@ -153,6 +165,18 @@ sys_readwrite(int fd, userptr_t buf, size_t size, enum uio_rw rw,
 		goto fail;
 	}
 
+#if !OPT_DUMBVM
+	/* ...and mappings should see what's been written */
+	if (locked && rw == UIO_WRITE) {
+		result = pcache_update(file->of_vnode,
+			useruio.uio_offset - (size - useruio.uio_resid),
+			useruio.uio_offset);
+		if (result) {
+			goto fail;
+		}
+	}
+#endif
+
 	if (locked) {
 		/* set the offset to the updated offset in the uio */
 		file->of_offset = useruio.uio_offset;
@@ -48,6 +48,9 @@
 #include <openfile.h>
 #include <filetable.h>
 #include <syscall.h>
+#include <addrspace.h>
+#include <pcache.h>
+#include "opt-dumbvm.h"
 
 /*
  * Note: if you are receiving this code as a patch to integrate with
@@ -369,7 +372,7 @@ sys_fstat(int fd, userptr_t statptr)
 }
 
 /*
- * fsync - call VOP_FSYNC
+ * fsync - write back pages written through mmap, then call VOP_FSYNC
  */
 int
 sys_fsync(int fd)
@@ -387,6 +390,14 @@ sys_fsync(int fd)
 	 * and we're not using any of its non-constant fields.
 	 */
 
+#if !OPT_DUMBVM
+	/* The whole file; pcache_writeback stops at the end of it */
+	err = pcache_writeback(file->of_vnode, 0, (off_t)1 << 62);
+	if (err) {
+		filetable_put(curproc->p_filetable, fd, file);
+		return err;
+	}
+#endif
 	err = VOP_FSYNC(file->of_vnode);
 	filetable_put(curproc->p_filetable, fd, file);
 	return err;
@@ -399,6 +410,9 @@ int
 sys_ftruncate(int fd, off_t len)
 {
 	struct openfile *file;
+#if !OPT_DUMBVM
+	struct stat st;
+#endif
 	int err;
 
 	if (len < 0) {
@@ -423,7 +437,70 @@ sys_ftruncate(int fd, off_t len)
 	 * and we're not using any of its non-constant fields.
 	 */
 
+#if !OPT_DUMBVM
+	/*
+	 * Growing the file brings back whatever was cached past the old
+	 * end, so clear from there.
+	 */
+	err = VOP_STAT(file->of_vnode, &st);
+	if (err) {
+		filetable_put(curproc->p_filetable, fd, file);
+		return err;
+	}
+#endif
 	err = VOP_TRUNCATE(file->of_vnode, len);
+#if !OPT_DUMBVM
+	if (!err) {
+		pcache_truncate(file->of_vnode,
+				len < st.st_size ? len : st.st_size);
+	}
+#endif
 	filetable_put(curproc->p_filetable, fd, file);
 	return err;
 }
+
+/*
+ * mmap - map a file, shared, with as_mmap
+ *
+ * The file must be open for reading, and for writing too if the
+ * mapping is to be writeable, since writes to it go to the file.
+ */
+int
+sys_mmap(size_t len, int prot, int fd, off_t offset, int32_t *retval)
+{
+	struct openfile *file;
+	vaddr_t addr;
+	int err;
+
+	if ((prot & ~(PROT_READ | PROT_WRITE)) != 0) {
+		return EINVAL;
+	}
+
+	err = filetable_get(curproc->p_filetable, fd, &file);
+	if (err) {
+		return err;
+	}
+
+	if (file->of_accmode == O_WRONLY ||
+	    ((prot & PROT_WRITE) && file->of_accmode != O_RDWR)) {
+		filetable_put(curproc->p_filetable, fd, file);
+		return EACCES;
+	}
+
+	err = as_mmap(proc_getas(), file->of_vnode, len, prot, offset, &addr);
+	filetable_put(curproc->p_filetable, fd, file);
+	if (err) {
+		return err;
+	}
+	*retval = addr;
+	return 0;
+}
+
+/*
+ * munmap - remove a mapping made by mmap
+ */
+int
+sys_munmap(userptr_t addr)
+{
+	return as_munmap(proc_getas(), (vaddr_t)addr);
+}
@@ -40,6 +40,7 @@
 #include <thread.h>
 #include <proc.h>
 #include <current.h>
+#include <addrspace.h>
 #include <copyinout.h>
 #include <pid.h>
 #include <syscall.h>
@@ -58,6 +59,25 @@ sys_getpid(pid_t *retval)
 	return 0;
 }
 
+/*
+ * sys_sbrk
+ *
+ * Returns the old break. The heap itself is managed by as_sbrk.
+ */
+int
+sys_sbrk(intptr_t amount, int32_t *retval)
+{
+	vaddr_t oldbreak;
+	int result;
+
+	result = as_sbrk(proc_getas(), amount, &oldbreak);
+	if (result) {
+		return result;
+	}
+	*retval = oldbreak;
+	return 0;
+}
+
 /*
  * sys__exit()
  *
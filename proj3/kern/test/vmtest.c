@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Tests and statistics for the VM system.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <vm.h>
+#include <addrspace.h>
+#include <test.h>
+
+#include "opt-dumbvm.h"
+
+////////////////////////////////////////////////////////////
+// fm
+
+/*
+ * Time FM_ROUNDS allocations of NPAGES frames, followed by freeing
+ * them again, and print the average cost of each.
+ */
+
+#define FM_ROUNDS 256
+
+static
+void
+fm_time(unsigned npages)
+{
+	static vaddr_t pages[FM_ROUNDS];
+	struct timespec before, middle, after, diff;
+	uint64_t allocns, freens;
+	unsigned i, n;
+
+	gettime(&before);
+	for (n=0; n<FM_ROUNDS; n++) {
+		pages[n] = alloc_kpages(npages);
+		if (pages[n] == 0) {
+			break;
+		}
+	}
+	gettime(&middle);
+	for (i=0; i<n; i++) {
+		free_kpages(pages[i]);
+	}
+	gettime(&after);
+
+	if (n == 0) {
+		kprintf("%3u page(s): no memory\n", npages);
+		return;
+	}
+
+	timespec_sub(&middle, &before, &diff);
+	allocns = diff.tv_sec * 1000000000ULL + diff.tv_nsec;
+	timespec_sub(&after, &middle, &diff);
+	freens = diff.tv_sec * 1000000000ULL + diff.tv_nsec;
+
+	kprintf("%3u page(s): %u allocs, %llu ns/alloc, %llu ns/free\n",
+		npages, n, allocns / n, freens / n);
+}
+
+/*
+ * Report frame table fragmentation and the latency of single and
+ * multiframe allocations.
+ */
+int
+frametest(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	frame_printstats();
+
+	kprintf("Allocation latency:\n");
+	fm_time(1);
+	fm_time(4);
+	fm_time(16);
+
+	return 0;
+}
+
+#if !OPT_DUMBVM
+
+////////////////////////////////////////////////////////////
+// rg
+
+/*
+ * Microbenchmark for the region lookup done by vm_fault on the first
+ * touch of every page. Builds an address space of RG_NREGIONS one page
+ * regions (defined out of order, with a page gap between each) and
+ * times lookups that walk across them in order, that jump around
+ * between them, and that fall into the gaps.
+ */
+
+#define RG_NREGIONS 512		/* must be a power of two */
+#define RG_ROUNDS   8
+#define RG_BASE     0x00400000
+
+static
+vaddr_t
+rg_addr(unsigned n)
+{
+	return RG_BASE + n * 2 * PAGE_SIZE;
+}
+
+/*
+ * Time RG_ROUNDS passes over the regions, visiting region (i * STRIDE)
+ * mod RG_NREGIONS on step i. An odd stride visits every region once.
+ */
+static
+int
+rg_time(struct addrspace *as, const char *name, unsigned stride,
+	vaddr_t offset)
+{
+	struct timespec before, after, diff;
+	struct region *rg;
+	uint64_t ns;
+	unsigned r, i, n;
+	int result, expect;
+
+	expect = offset < PAGE_SIZE ? 0 : EFAULT;
+
+	gettime(&before);
+	for (r=0; r<RG_ROUNDS; r++) {
+		for (i=0; i<RG_NREGIONS; i++) {
+			n = (i * stride) % RG_NREGIONS;
+			result = region_lookup(as, rg_addr(n) + offset,
+					       VM_FAULT_READ, &rg);
+			if (result != expect) {
+				kprintf("rg: lookup of region %u returned %d\n",
+					n, result);
+				return EINVAL;
+			}
+			if (result == 0 && rg->base_addr != rg_addr(n)) {
+				kprintf("rg: lookup of region %u found 0x%x\n",
+					n, rg->base_addr);
+				return EINVAL;
+			}
+		}
+	}
+	gettime(&after);
+
+	timespec_sub(&after, &before, &diff);
+	ns = diff.tv_sec * 1000000000ULL + diff.tv_nsec;
+	kprintf("%-12s %llu ns/lookup\n", name,
+		ns / (RG_ROUNDS * RG_NREGIONS));
+	return 0;
+}
+
+int
+regiontest(int nargs, char **args)
+{
+	struct addrspace *as;
+	unsigned i;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	as = as_create();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+
+	for (i=0; i<RG_NREGIONS; i++) {
+		result = as_define_region(as, rg_addr((i * 7) % RG_NREGIONS),
+					  PAGE_SIZE, 1, 1, 0);
+		if (result) {
+			kprintf("rg: as_define_region: %s\n", strerror(result));
+			as_destroy(as);
+			return result;
+		}
+	}
+
+	kprintf("Region lookup across %u regions:\n", RG_NREGIONS);
+	result = rg_time(as, "sequential", 1, 0);
+	if (!result) {
+		result = rg_time(as, "scattered", 37, PAGE_SIZE / 2);
+	}
+	if (!result) {
+		result = rg_time(as, "misses", 1, PAGE_SIZE + 4);
+	}
+
+	as_destroy(as);
+	return result;
+}
+
+#endif /* !OPT_DUMBVM */
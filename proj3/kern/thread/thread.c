@@ -53,6 +53,8 @@
 #include <mainbus.h>
 #include <vnode.h>
 #include <pid.h>
+#include <zeropool.h>
+#include "opt-dumbvm.h"
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -142,6 +144,7 @@ thread_create(const char *name)
 	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
+	thread->t_bound = false;
 	thread->t_proc = NULL;
 	HANGMAN_ACTORINIT(&thread->t_hangman, thread->t_name);
 
@@ -151,6 +154,7 @@ thread_create(const char *name)
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
 	/* If you add to struct thread, be sure to initialize here */
+	thread->t_reclaiming = false;
 
 	return thread;
 }
@@ -491,14 +495,17 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
  * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
  *
  * The new thread is created in the process P. If P is null, the
- * process is inherited from the caller. It will start on the same CPU
- * as the caller, unless the scheduler intervenes first.
+ * process is inherited from the caller. If BINDTO is null it will
+ * start on the same CPU as the caller, unless the scheduler intervenes
+ * first; otherwise it runs on BINDTO and is never migrated.
  */
+static
 int
-thread_fork(const char *name,
-	    struct proc *proc,
-	    void (*entrypoint)(void *data1, unsigned long data2),
-	    void *data1, unsigned long data2)
+thread_fork_common(const char *name,
+		   struct proc *proc,
+		   struct cpu *bindto,
+		   void (*entrypoint)(void *data1, unsigned long data2),
+		   void *data1, unsigned long data2)
 {
 	struct thread *newthread;
 	int result;
@@ -521,7 +528,13 @@ thread_fork(const char *name,
 	 */
 
 	/* Thread subsystem fields */
-	newthread->t_cpu = curthread->t_cpu;
+	if (bindto != NULL) {
+		newthread->t_cpu = bindto;
+		newthread->t_bound = true;
+	}
+	else {
+		newthread->t_cpu = curthread->t_cpu;
+	}
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -544,12 +557,41 @@ thread_fork(const char *name,
 	/* Set up the switchframe so entrypoint() gets called */
 	switchframe_init(newthread, entrypoint, data1, data2);
 
-	/* Lock the current cpu's run queue and make the new thread runnable */
+	/* Lock the new thread's cpu's run queue and make it runnable */
 	thread_make_runnable(newthread, false);
 
 	return 0;
 }
 
+int
+thread_fork(const char *name,
+	    struct proc *proc,
+	    void (*entrypoint)(void *data1, unsigned long data2),
+	    void *data1, unsigned long data2)
+{
+	return thread_fork_common(name, proc, NULL, entrypoint, data1, data2);
+}
+
+int
+thread_fork_bound(const char *name,
+		  struct proc *proc,
+		  unsigned cpunum,
+		  void (*entrypoint)(void *data1, unsigned long data2),
+		  void *data1, unsigned long data2)
+{
+	struct cpu *c;
+
+	KASSERT(cpunum < cpuarray_num(&allcpus));
+	c = cpuarray_get(&allcpus, cpunum);
+	return thread_fork_common(name, proc, c, entrypoint, data1, data2);
+}
+
+unsigned
+thread_ncpus(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
 /*
  * High level, machine-independent context switch code.
  *
@@ -639,6 +681,10 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	 * Note that c_isidle becomes true briefly even if we don't go
 	 * idle. However, because one is supposed to hold the runqueue
 	 * lock to look at it, this should not be visible or matter.
+	 *
+	 * Before idling, see if the VM system has background work (the
+	 * zeroed frame pool wants filling); if so this cpu's zeroing
+	 * thread is now on our runqueue, so look at it again.
 	 */
 
 	/* The current cpu is now idle. */
@@ -647,7 +693,13 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		next = threadlist_remhead(&curcpu->c_runqueue);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
+#if OPT_DUMBVM
 			cpu_idle();
+#else
+			if (!zeropool_idle()) {
+				cpu_idle();
+			}
+#endif
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -807,6 +859,21 @@ thread_exit(void)
 	panic("braaaaaaaiiiiiiiiiiinssssss\n");
 }
 
+/*
+ * The counts are read without locking the other cpus' lists, so this
+ * is only a snapshot.
+ */
+unsigned
+thread_nzombies(void)
+{
+	unsigned i, n = 0;
+
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		n += cpuarray_get(&allcpus, i)->c_zombies.tl_count;
+	}
+	return n;
+}
+
 /*
  * Yield the cpu to another process, but stay runnable.
  */
@@ -922,6 +989,13 @@ thread_consider_migration(void)
 				continue;
 			}
 
+			/* Bound threads stay put the same way. */
+			if (t->t_bound) {
+				threadlist_addtail(&victims, t);
+				to_send--;
+				continue;
+			}
+
 			t->t_cpu = c;
 			threadlist_addtail(&c->c_runqueue, t);
 			DEBUG(DB_THREADS,
@@ -1167,6 +1241,27 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Send a TLB shootdown IPI to all CPUs other than this one. Returns
+ * the number of CPUs it was sent to.
+ */
+unsigned
+ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping)
+{
+	unsigned i, n;
+	struct cpu *c;
+
+	n = 0;
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self) {
+			ipi_tlbshootdown(c, mapping);
+			n++;
+		}
+	}
+	return n;
+}
+
 /*
  * Handle an incoming interprocessor interrupt.
  */
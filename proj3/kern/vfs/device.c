@@ -242,9 +242,11 @@ null_fsync(struct vnode *v)
  */
 static
 int
-dev_mmap(struct vnode *v  /* add stuff as needed */)
+dev_mmap(struct vnode *v, off_t offset, size_t len)
 {
 	(void)v;
+	(void)offset;
+	(void)len;
 	return ENOSYS;
 }
 
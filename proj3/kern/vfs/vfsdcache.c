@@ -0,0 +1,460 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * VFS name cache.
+ *
+ * Remembers what VOP_LOOKUP said for a (directory, name) pair: either
+ * the vnode the name refers to, or that there is no such name (a
+ * negative entry). vfs_lookup and vfs_lookparent walk paths one
+ * component at a time through here, so repeated lookups of the same
+ * names don't go to the filesystem and read the directory again.
+ *
+ * There is a fixed pool of DCACHE_SIZE entries, found through a hash
+ * table and recycled least recently used first. An entry holds a
+ * reference to the directory and, unless negative, to the vnode it
+ * names, so neither can be reclaimed (and its address reused) while
+ * the entry exists. Names longer than DCACHE_NAMELEN, and "." and
+ * "..", are never cached.
+ *
+ * The vfs_* operations that change names call vfs_dcache_forget after
+ * changing them. Every invalidation bumps dcache_gen, and an entry is
+ * only added if nothing has been invalidated since the lookup that
+ * produced it started; otherwise a lookup racing with (say) a remove
+ * could cache the name after the remove had forgotten it.
+ *
+ * References are never dropped with dcache_lock held, as the last one
+ * goes to VOP_RECLAIM.
+ */
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vfs.h>
+#include <vnode.h>
+
+#define DCACHE_SIZE	256	/* entries */
+#define DCACHE_HASH	128	/* hash chains */
+#define DCACHE_NAMELEN	31	/* longest name cached */
+
+struct dcache_entry {
+	struct vnode *de_dir;		/* directory, or NULL if unused */
+	struct vnode *de_vn;		/* what the name is; NULL if nothing */
+	char de_name[DCACHE_NAMELEN+1];
+	struct dcache_entry *de_hashnext;	/* hash chain */
+	struct dcache_entry *de_lruprev;	/* LRU list (all entries) */
+	struct dcache_entry *de_lrunext;
+};
+
+/* Everything here is protected by dcache_lock */
+static struct spinlock dcache_lock = SPINLOCK_INITIALIZER;
+static struct dcache_entry dcache_entries[DCACHE_SIZE];
+static struct dcache_entry *dcache_hash[DCACHE_HASH];
+static struct dcache_entry *dcache_lruhead;	/* most recently used */
+static struct dcache_entry *dcache_lrutail;	/* next to be recycled */
+static unsigned dcache_gen;			/* bumped on invalidation */
+static unsigned dcache_inuse;
+
+/* Statistics */
+static uint32_t dcache_lookups;		/* lookups of cacheable names */
+static uint32_t dcache_hits;		/* ...that found the vnode */
+static uint32_t dcache_neghits;		/* ...that found "no such name" */
+static uint32_t dcache_evicted;		/* entries recycled for others */
+static uint32_t dcache_invalidated;	/* entries forgotten or purged */
+
+////////////////////////////////////////////////////////////
+//
+// Hash table and LRU list
+
+static
+bool
+dcache_cacheable(const char *name)
+{
+	if (name[0] == 0 || !strcmp(name, ".") || !strcmp(name, "..")) {
+		return false;
+	}
+	return strlen(name) <= DCACHE_NAMELEN;
+}
+
+static
+unsigned
+dcache_hashfn(struct vnode *dir, const char *name)
+{
+	unsigned h = (uintptr_t)dir / sizeof(void *);
+
+	while (*name) {
+		h = h * 31 + (unsigned char)*name++;
+	}
+	return h % DCACHE_HASH;
+}
+
+static
+struct dcache_entry *
+dcache_find(struct vnode *dir, const char *name)
+{
+	struct dcache_entry *e;
+
+	for (e = dcache_hash[dcache_hashfn(dir, name)]; e != NULL;
+	     e = e->de_hashnext) {
+		if (e->de_dir == dir && !strcmp(e->de_name, name)) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+dcache_lruremove(struct dcache_entry *e)
+{
+	if (e->de_lruprev != NULL) {
+		e->de_lruprev->de_lrunext = e->de_lrunext;
+	}
+	else {
+		dcache_lruhead = e->de_lrunext;
+	}
+	if (e->de_lrunext != NULL) {
+		e->de_lrunext->de_lruprev = e->de_lruprev;
+	}
+	else {
+		dcache_lrutail = e->de_lruprev;
+	}
+	e->de_lruprev = e->de_lrunext = NULL;
+}
+
+static
+void
+dcache_lruaddhead(struct dcache_entry *e)
+{
+	e->de_lruprev = NULL;
+	e->de_lrunext = dcache_lruhead;
+	if (dcache_lruhead != NULL) {
+		dcache_lruhead->de_lruprev = e;
+	}
+	else {
+		dcache_lrutail = e;
+	}
+	dcache_lruhead = e;
+}
+
+static
+void
+dcache_lruaddtail(struct dcache_entry *e)
+{
+	e->de_lrunext = NULL;
+	e->de_lruprev = dcache_lrutail;
+	if (dcache_lrutail != NULL) {
+		dcache_lrutail->de_lrunext = e;
+	}
+	else {
+		dcache_lruhead = e;
+	}
+	dcache_lrutail = e;
+}
+
+/*
+ * Take an entry out of use, handing back the references it held for
+ * the caller to drop once dcache_lock is released. The entry goes to
+ * the tail of the LRU list to be reused first.
+ */
+static
+void
+dcache_drop(struct dcache_entry *e, struct vnode **dir, struct vnode **vn)
+{
+	struct dcache_entry **pe;
+
+	KASSERT(spinlock_do_i_hold(&dcache_lock));
+	KASSERT(e->de_dir != NULL);
+
+	pe = &dcache_hash[dcache_hashfn(e->de_dir, e->de_name)];
+	while (*pe != e) {
+		KASSERT(*pe != NULL);
+		pe = &(*pe)->de_hashnext;
+	}
+	*pe = e->de_hashnext;
+	e->de_hashnext = NULL;
+
+	*dir = e->de_dir;
+	*vn = e->de_vn;
+	e->de_dir = NULL;
+	e->de_vn = NULL;
+	dcache_inuse--;
+
+	dcache_lruremove(e);
+	dcache_lruaddtail(e);
+}
+
+/*
+ * Drop the references handed back by dcache_drop.
+ */
+static
+void
+dcache_release(struct vnode *dir, struct vnode *vn)
+{
+	if (vn != NULL) {
+		VOP_DECREF(vn);
+	}
+	if (dir != NULL) {
+		VOP_DECREF(dir);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Interface
+
+/*
+ * Look up NAME in DIR. Returns true if the answer is cached, with
+ * *RET set to a new reference to the vnode, or to NULL if the name
+ * doesn't exist. Either way *GEN is set, for vfs_dcache_enter.
+ */
+bool
+vfs_dcache_lookup(struct vnode *dir, const char *name, struct vnode **ret,
+		  unsigned *gen)
+{
+	struct dcache_entry *e;
+
+	spinlock_acquire(&dcache_lock);
+	*gen = dcache_gen;
+	if (!dcache_cacheable(name)) {
+		spinlock_release(&dcache_lock);
+		return false;
+	}
+	dcache_lookups++;
+	e = dcache_find(dir, name);
+	if (e == NULL) {
+		spinlock_release(&dcache_lock);
+		return false;
+	}
+
+	if (e->de_vn != NULL) {
+		VOP_INCREF(e->de_vn);
+		dcache_hits++;
+	}
+	else {
+		dcache_neghits++;
+	}
+	*ret = e->de_vn;
+
+	dcache_lruremove(e);
+	dcache_lruaddhead(e);
+	spinlock_release(&dcache_lock);
+	return true;
+}
+
+/*
+ * Remember that NAME in DIR is VN, or doesn't exist if VN is NULL.
+ * GEN is what vfs_dcache_lookup handed out before the filesystem was
+ * asked; if anything has been invalidated since, the answer may
+ * already be stale and isn't kept.
+ */
+void
+vfs_dcache_enter(struct vnode *dir, const char *name, struct vnode *vn,
+		 unsigned gen)
+{
+	struct dcache_entry *e;
+	struct vnode *olddir = NULL, *oldvn = NULL;
+
+	if (!dcache_cacheable(name)) {
+		return;
+	}
+
+	spinlock_acquire(&dcache_lock);
+	if (gen != dcache_gen || dcache_find(dir, name) != NULL) {
+		spinlock_release(&dcache_lock);
+		return;
+	}
+
+	e = dcache_lrutail;
+	KASSERT(e != NULL);
+	if (e->de_dir != NULL) {
+		dcache_drop(e, &olddir, &oldvn);
+		dcache_evicted++;
+	}
+
+	VOP_INCREF(dir);
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+	e->de_dir = dir;
+	e->de_vn = vn;
+	strcpy(e->de_name, name);
+	e->de_hashnext = dcache_hash[dcache_hashfn(dir, name)];
+	dcache_hash[dcache_hashfn(dir, name)] = e;
+	dcache_inuse++;
+
+	dcache_lruremove(e);
+	dcache_lruaddhead(e);
+	spinlock_release(&dcache_lock);
+
+	dcache_release(olddir, oldvn);
+}
+
+/*
+ * Forget whatever is cached for NAME in DIR. Called after NAME has
+ * (or might have) changed.
+ */
+void
+vfs_dcache_forget(struct vnode *dir, const char *name)
+{
+	struct dcache_entry *e;
+	struct vnode *olddir = NULL, *oldvn = NULL;
+
+	spinlock_acquire(&dcache_lock);
+	dcache_gen++;
+	e = dcache_cacheable(name) ? dcache_find(dir, name) : NULL;
+	if (e != NULL) {
+		dcache_drop(e, &olddir, &oldvn);
+		dcache_invalidated++;
+	}
+	spinlock_release(&dcache_lock);
+
+	dcache_release(olddir, oldvn);
+}
+
+/*
+ * Drop every entry that involves VN (if not NULL) or a directory on
+ * FS (if not NULL), or if both are NULL every entry there is.
+ * Dropping a reference can sleep, so go round once per entry.
+ */
+static
+void
+dcache_purge(struct vnode *vn, struct fs *fs)
+{
+	struct dcache_entry *e;
+	struct vnode *olddir, *oldvn;
+	unsigned i;
+
+	while (1) {
+		olddir = oldvn = NULL;
+
+		spinlock_acquire(&dcache_lock);
+		dcache_gen++;
+		for (i=0; i<DCACHE_SIZE; i++) {
+			e = &dcache_entries[i];
+			if (e->de_dir == NULL) {
+				continue;
+			}
+			if ((vn == NULL && fs == NULL)
+			    || (vn != NULL &&
+				(e->de_dir == vn || e->de_vn == vn))
+			    || (fs != NULL && e->de_dir->vn_fs == fs)) {
+				dcache_drop(e, &olddir, &oldvn);
+				dcache_invalidated++;
+				break;
+			}
+		}
+		spinlock_release(&dcache_lock);
+
+		if (olddir == NULL) {
+			break;
+		}
+		dcache_release(olddir, oldvn);
+	}
+}
+
+/*
+ * Drop every entry for names in VN or naming VN. Used when VN is a
+ * directory that has been removed.
+ */
+void
+vfs_dcache_purgevnode(struct vnode *vn)
+{
+	dcache_purge(vn, NULL);
+}
+
+/*
+ * Drop every entry on FS, so the references they hold don't keep it
+ * from being unmounted.
+ */
+void
+vfs_dcache_purgefs(struct fs *fs)
+{
+	dcache_purge(NULL, fs);
+}
+
+/*
+ * Drop every entry, so that the vnodes they hold (and any pages cached
+ * for them) can go. Used when measuring memory use.
+ */
+void
+vfs_dcache_purgeall(void)
+{
+	dcache_purge(NULL, NULL);
+}
+
+/*
+ * Print the hit rate. With RESET the counts start over.
+ */
+void
+vfs_dcache_printstats(bool reset)
+{
+	uint32_t lookups, hits, neghits, evicted, invalidated;
+	unsigned inuse;
+
+	/* Copy the counts out; kprintf shouldn't run under a spinlock */
+	spinlock_acquire(&dcache_lock);
+	inuse = dcache_inuse;
+	lookups = dcache_lookups;
+	hits = dcache_hits;
+	neghits = dcache_neghits;
+	evicted = dcache_evicted;
+	invalidated = dcache_invalidated;
+	if (reset) {
+		dcache_lookups = dcache_hits = dcache_neghits = 0;
+		dcache_evicted = dcache_invalidated = 0;
+	}
+	spinlock_release(&dcache_lock);
+
+	kprintf("vfs name cache: %u entries, %u in use\n",
+		DCACHE_SIZE, inuse);
+	kprintf("%u lookups, %u hits, %u negative hits (%u%%), "
+		"%u evicted, %u invalidated\n",
+		lookups, hits, neghits,
+		lookups ? (hits + neghits) * 100 / lookups : 0,
+		evicted, invalidated);
+}
+
+/*
+ * Setup function: put every entry on the LRU list, unused.
+ */
+void
+vfs_dcache_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<DCACHE_SIZE; i++) {
+		dcache_entries[i].de_dir = NULL;
+		dcache_entries[i].de_vn = NULL;
+		dcache_entries[i].de_hashnext = NULL;
+		dcache_lruaddtail(&dcache_entries[i]);
+	}
+	for (i=0; i<DCACHE_HASH; i++) {
+		dcache_hash[i] = NULL;
+	}
+}
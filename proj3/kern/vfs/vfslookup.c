@@ -35,6 +35,7 @@
 #include <kern/errno.h>
 #include <limits.h>
 #include <lib.h>
+#include <stat.h>
 #include <synch.h>
 #include <vfs.h>
 #include <fs.h>
@@ -234,16 +235,110 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 	return 0;
 }
 
+/*
+ * Look up a single name in DIR, going to the filesystem only if the
+ * name cache doesn't know the answer.
+ */
+static
+int
+lookup_name(struct vnode *dir, char *name, struct vnode **ret)
+{
+	unsigned gen;
+	int result;
+
+	if (vfs_dcache_lookup(dir, name, ret, &gen)) {
+		return *ret == NULL ? ENOENT : 0;
+	}
+
+	result = VOP_LOOKUP(dir, name, ret);
+	if (result == 0) {
+		vfs_dcache_enter(dir, name, *ret, gen);
+	}
+	else if (result == ENOENT) {
+		vfs_dcache_enter(dir, name, NULL, gen);
+	}
+	return result;
+}
+
+/*
+ * Look up PATH relative to DIR one component at a time, so each step
+ * can be answered by the name cache. Empty components are skipped.
+ * A trailing slash means the result has to be a directory. Destroys
+ * PATH.
+ */
+static
+int
+lookup_path(struct vnode *dir, char *path, struct vnode **ret)
+{
+	struct vnode *cur, *next;
+	char *name, *slash;
+	bool trailing = false;
+	uint32_t type;
+	int result;
+
+	VOP_INCREF(dir);
+	cur = dir;
+
+	name = path;
+	while (1) {
+		while (*name == '/') {
+			trailing = true;
+			name++;
+		}
+		if (*name == 0) {
+			break;
+		}
+		trailing = false;
+
+		slash = strchr(name, '/');
+		if (slash != NULL) {
+			*slash = 0;
+		}
+
+		result = lookup_name(cur, name, &next);
+		VOP_DECREF(cur);
+		if (result) {
+			return result;
+		}
+		cur = next;
+
+		if (slash == NULL) {
+			break;
+		}
+		name = slash + 1;
+		trailing = true;
+	}
+
+	if (trailing) {
+		result = VOP_GETTYPE(cur, &type);
+		if (result == 0 && (type & S_IFMT) != S_IFDIR) {
+			result = ENOTDIR;
+		}
+		if (result) {
+			VOP_DECREF(cur);
+			return result;
+		}
+	}
+
+	*ret = cur;
+	return 0;
+}
+
 /*
  * Name-to-vnode translation.
  * (In BSD, both of these are subsumed by namei().)
+ *
+ * Everything up to the last component goes through lookup_path and
+ * the name cache; the last component of a lookparent is handed to
+ * VOP_LOOKPARENT, as only the filesystem knows what a valid name is.
  */
 
 int
 vfs_lookparent(char *path, struct vnode **retval,
 	       char *buf, size_t buflen)
 {
-	struct vnode *startvn;
+	struct vnode *startvn, *dir;
+	char *last;
 	int result;
 
 	vfs_biglock_acquire();
@@ -254,6 +349,7 @@ vfs_lookparent(char *path, struct vnode **retval,
 		return result;
 	}
 
+	last = strrchr(path, '/');
 	if (strlen(path)==0) {
 		/*
 		 * It does not make sense to use just a device name in
@@ -262,9 +358,19 @@ vfs_lookparent(char *path, struct vnode **retval,
 		 */
 		result = EINVAL;
 	}
-	else {
+	else if (last == NULL || last[1] == 0) {
+		/* One name, or a trailing slash: let the fs decide */
 		result = VOP_LOOKPARENT(startvn, path, retval, buf, buflen);
 	}
+	else {
+		*last = 0;
+		result = lookup_path(startvn, path, &dir);
+		if (result == 0) {
+			result = VOP_LOOKPARENT(dir, last+1, retval,
+						buf, buflen);
+			VOP_DECREF(dir);
+		}
+	}
 
 	VOP_DECREF(startvn);
 
@@ -292,7 +398,7 @@ vfs_lookup(char *path, struct vnode **retval)
 		return 0;
 	}
 
-	result = VOP_LOOKUP(startvn, path, retval);
+	result = lookup_path(startvn, path, retval);
 
 	VOP_DECREF(startvn);
 	vfs_biglock_release();
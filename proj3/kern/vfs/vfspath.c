@@ -38,8 +38,16 @@
 #include <lib.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <pcache.h>
+#include "opt-dumbvm.h"
 
 
+/*
+ * Operations here that change a name (including open with O_CREAT)
+ * tell the name cache (see vfsdcache.c) afterwards, whether or not
+ * they succeeded.
+ */
+
 /* Does most of the work for open(). */
 int
 vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
@@ -74,6 +82,7 @@ vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
 		}
 
 		result = VOP_CREAT(dir, name, excl, mode, &vn);
+		vfs_dcache_forget(dir, name);
 
 		VOP_DECREF(dir);
 	}
@@ -99,6 +108,11 @@ vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
 		}
 		else {
 			result = VOP_TRUNCATE(vn, 0);
+#if !OPT_DUMBVM
+			if (result == 0) {
+				pcache_truncate(vn, 0);
+			}
+#endif
 		}
 		if (result) {
 			VOP_DECREF(vn);
@@ -146,6 +160,7 @@ vfs_remove(char *path)
 	}
 
 	result = VOP_REMOVE(dir, name);
+	vfs_dcache_forget(dir, name);
 	VOP_DECREF(dir);
 
 	return result;
@@ -179,6 +194,8 @@ vfs_rename(char *oldpath, char *newpath)
 	}
 
 	result = VOP_RENAME(olddir, oldname, newdir, newname);
+	vfs_dcache_forget(olddir, oldname);
+	vfs_dcache_forget(newdir, newname);
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(olddir);
@@ -213,6 +230,7 @@ vfs_link(char *oldpath, char *newpath)
 	}
 
 	result = VOP_LINK(newdir, newname, oldfile);
+	vfs_dcache_forget(newdir, newname);
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(oldfile);
@@ -240,6 +258,7 @@ vfs_symlink(const char *contents, char *path)
 	}
 
 	result = VOP_SYMLINK(newdir, newname, contents);
+	vfs_dcache_forget(newdir, newname);
 	VOP_DECREF(newdir);
 
 	return result;
@@ -286,6 +305,7 @@ vfs_mkdir(char *path, mode_t mode)
 	}
 
 	result = VOP_MKDIR(parent, name, mode);
+	vfs_dcache_forget(parent, name);
 
 	VOP_DECREF(parent);
 
@@ -298,7 +318,7 @@ vfs_mkdir(char *path, mode_t mode)
 int
 vfs_rmdir(char *path)
 {
-	struct vnode *parent;
+	struct vnode *parent, *dir;
 	char name[NAME_MAX+1];
 	int result;
 
@@ -307,8 +327,23 @@ vfs_rmdir(char *path)
 		return result;
 	}
 
+	/*
+	 * Get the directory itself too, so that once it's gone the
+	 * name cache can let go of it and anything cached in it.
+	 */
+	result = VOP_LOOKUP(parent, name, &dir);
+	if (result) {
+		VOP_DECREF(parent);
+		return result;
+	}
+
 	result = VOP_RMDIR(parent, name);
+	vfs_dcache_forget(parent, name);
+	if (result == 0) {
+		vfs_dcache_purgevnode(dir);
+	}
 
+	VOP_DECREF(dir);
 	VOP_DECREF(parent);
 
 	return result;
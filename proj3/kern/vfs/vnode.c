@@ -36,6 +36,8 @@
 #include <synch.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <pcache.h>
+#include "opt-dumbvm.h"
 
 /*
  * Initialize an abstract vnode.
@@ -113,6 +115,10 @@ vnode_decref(struct vnode *vn)
 	spinlock_release(&vn->vn_countlock);
 
 	if (destroy) {
+#if !OPT_DUMBVM
+		/* Cached pages of the file are keyed by the vnode */
+		pcache_purge(vn);
+#endif
 		result = VOP_RECLAIM(vn);
 		if (result != 0 && result != EBUSY) {
 			// XXX: lame.
@@ -27,6 +27,8 @@
  * SUCH DAMAGE.
  */
 
+#define ADDRSPACEINLINE
+
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
@@ -38,6 +40,10 @@
 #include <vm.h>
 #include <proc.h>
 #include <synch.h>
+#include <swap.h>
+#include <vnode.h>
+#include <pcache.h>
+#include <ptpool.h>
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
@@ -50,6 +56,12 @@
  */
 struct region *create_region(vaddr_t vaddr, size_t memsize,
 		 int readable, int writeable, int executable);
+static int insert_region(struct addrspace *as, struct region *rg);
+static void as_unmap(struct addrspace *as, vaddr_t start, vaddr_t end);
+static vaddr_t next_region(struct addrspace *as, vaddr_t vaddr);
+
+/* Stack limit for new address spaces, changed by as_setstackmax */
+static unsigned stack_maxpages = STACK_MAXPAGES;
 
 struct addrspace *
 as_create(void)
@@ -61,88 +73,222 @@ as_create(void)
 		return NULL;
 	}
 
-	/* Create level one hierarchy of page table */
-	paddr_t **pg_table;
-	pg_table = kmalloc(PG_TABLE_ONE * sizeof(paddr_t *));
-	if (pg_table == NULL) {
-		kfree(as);
-		return NULL;
+	/* The page table starts empty, with no directory (see pt_table) */
+	as->page_table = NULL;
+	for (int i = 0; i < PT_INLINE; i++) {
+		as->pt_inline[i] = NULL;
+		as->pt_inline_slot[i] = 0;
 	}
-
-	for (int i = 0; i < PG_TABLE_ONE; i++) {
-		pg_table[i] = NULL;
+	as->pt_ninline = 0;
+	for (int i = 0; i < PG_TABLE_ONE / 32; i++) {
+		as->pt_used[i] = 0;
+	}
+	for (int i = 0; i < MAXCPUS; i++) {
+		as->as_asid[i] = 0;
 	}
 
-	as->head = NULL;
-	as->page_table = pg_table;
+	regionarray_init(&as->regions);
+	as->last_region = NULL;
+	as->as_heap = NULL;
+	as->as_heapend = 0;
+	as->as_stack = NULL;
+	as->as_stackmax = 0;
+	spinlock_init(&as->pt_lock);
 
 	return as;
 }
 
+/*
+ * Fork the address space copy-on-write. The regions are duplicated,
+ * but rather than copying any frames, every page is mapped read-only
+ * in both page tables and the frame's reference count is bumped. The
+ * first write to such a page from either side faults, and vm_fault
+ * then gives the writer its own copy.
+ *
+ * Pages that are out in swap just get another reference to their
+ * slot; each side reads its own copy back in when it next touches it.
+ *
+ * A shared frame has no owner, so it stays in memory until one side
+ * writes to it or lets it go.
+ */
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *as_copy;
+	int result;
 
 	as_copy = as_create();
 	if (as_copy==NULL) {
 		return ENOMEM;
 	}
-	memcpy(as_copy, old, sizeof(struct addrspace));
-
-	struct region *curr_old = old->head;
-	struct region *curr_copy = as_copy->head;
-	while(curr_old != NULL) {
-		/* sus: curr_old->rise is most like 4 KiB. Usually, 1 KiB is passed in and 
-		aligned to 4 Kib. So, not sure if passed in 4 KiB, it will stay 4 KiB or
-		not */
-		int result = as_define_region(as_copy, curr_old->base_addr, curr_old->r_size,
-									curr_old->read, curr_old->write, curr_old->exec);
-		if (result) {
-			panic("error: as_copy: could not allocate region for copy");
+
+	/* Duplicate the regions, which are already in sorted order */
+	unsigned nregions = regionarray_num(&old->regions);
+	for (unsigned i = 0; i < nregions; i++) {
+		struct region *curr_old = regionarray_get(&old->regions, i);
+		struct region *rg = create_region(curr_old->base_addr, curr_old->r_size,
+						curr_old->read, curr_old->write, curr_old->exec);
+		if (rg == NULL) {
+			as_destroy(as_copy);
+			return ENOMEM;
+		}
+		rg->ker_write = curr_old->ker_write;
+		rg->r_fvaddr = curr_old->r_fvaddr;
+		rg->r_foffset = curr_old->r_foffset;
+		rg->r_filesize = curr_old->r_filesize;
+		rg->r_vnode = curr_old->r_vnode;
+		rg->r_shared = curr_old->r_shared;
+		if (rg->r_vnode != NULL) {
+			VOP_INCREF(rg->r_vnode);
+		}
+		if (curr_old == old->as_heap) {
+			as_copy->as_heap = rg;
+			as_copy->as_heapend = old->as_heapend;
+		}
+		if (curr_old == old->as_stack) {
+			as_copy->as_stack = rg;
+			as_copy->as_stackmax = old->as_stackmax;
+		}
+		if (regionarray_add(&as_copy->regions, rg, NULL)) {
+			kfree(rg);
+			as_destroy(as_copy);
+			return ENOMEM;
+		}
+	}
+
+	/*
+	 * A parent with a directory gets the child one up front, so that
+	 * adding the child's tables below can't fail after the frames in
+	 * them have been referenced.
+	 */
+	if (old->page_table != NULL) {
+		as_copy->page_table = ptpool_get();
+		if (as_copy->page_table == NULL) {
+			as_destroy(as_copy);
 			return ENOMEM;
 		}
-		curr_copy = curr_copy->next;
-		curr_old = curr_old->next;
 	}
 
-	paddr_t **pg_table_copy;
-	pg_table_copy = kmalloc(PG_TABLE_ONE * sizeof(paddr_t *));
-	
+	/* Share every mapped frame read-only between the two page tables */
 	for (int i = 0; i < PG_TABLE_ONE; i++) {
-		if (old->page_table[i] != NULL) {
-			pg_table_copy[i] = kmalloc(PG_TABLE_TWO * sizeof(paddr_t));
-			memcpy(pg_table_copy[i], old->page_table[i], sizeof(paddr_t *));
-
-			// for (int j = 0; j < PG_TABLE_TWO; j++) {
-			// 	pg_table_copy[i][j] = NO_ENTRY;
-			// 	//memcpy(pg_table_copy[i][j], old->page_table[i][j], sizeof(paddr_t));
-			// }
-		} 
-		else {
-			pg_table_copy[i] = NULL;
+		if (!(old->pt_used[i / 32] & (1U << (i % 32)))) {
+			continue;
 		}
+
+		paddr_t *table = ptpool_get();
+		if (table == NULL) {
+			as_destroy(as_copy);
+			return ENOMEM;
+		}
+
+		/*
+		 * Hold off eviction while copying the parent's entries: a
+		 * slot the swapper has just put in an entry may not have
+		 * been written yet, and is taken back if the write fails.
+		 * (The table is got first, as that may have to evict.)
+		 */
+		swap_lock_acquire();
+		spinlock_acquire(&old->pt_lock);
+		paddr_t *old_table = pt_table(old, i);
+		for (int j = 0; j < PG_TABLE_TWO; j++) {
+			paddr_t pte = old_table[j];
+			if (pte & PTE_SWAPPED) {
+				swap_dup(PTE_TO_SLOT(pte));
+			}
+			else if (pte != NO_ENTRY) {
+				pte &= ~TLBLO_DIRTY;
+				old_table[j] = pte;
+				frame_incref(pte & PAGE_FRAME);
+			}
+			table[j] = pte;
+		}
+		spinlock_release(&old->pt_lock);
+		swap_lock_release();
+
+		result = pt_addtable(as_copy, i, table);
+		KASSERT(result == 0);
 	}
 
+	/* TLBs may still hold writeable entries for those pages */
+	tlb_forget(old);
+
 	*ret = as_copy;
 	return 0;
 }
 
+/*
+ * Tear down an address space: drop our reference on every mapped
+ * frame and swap slot, then give the level two tables and the
+ * directory (if any) back to the pool and free the regions. Only the
+ * level one slots marked in pt_used are visited.
+ *
+ * Each level two table is compacted in place into the list of frames
+ * it maps, and that list is handed to the frame allocator in one go,
+ * so freeing costs one frame table lock round trip per 2 MiB of
+ * address space in use rather than one per page.
+ *
+ * Eviction is held off throughout, since the clock hand may have
+ * picked one of our frames and be about to look at our page table.
+ */
 void
 as_destroy(struct addrspace *as)
 {
-	/* Go through page table entries and free the physical frames
-	 * convert the PFN to a VP and free
-	 */
+	swap_lock_acquire();
+	for (int w = 0; w < PG_TABLE_ONE / 32; w++) {
+		if (as->pt_used[w] == 0) {
+			continue;
+		}
+		for (int b = 0; b < 32; b++) {
+			if (!(as->pt_used[w] & (1U << b))) {
+				continue;
+			}
+
+			paddr_t *table = pt_table(as, w * 32 + b);
+			unsigned nframes = 0;
+			for (int j = 0; j < PG_TABLE_TWO; j++) {
+				if (table[j] & PTE_SWAPPED) {
+					swap_free(PTE_TO_SLOT(table[j]));
+				}
+				else if (table[j] != NO_ENTRY) {
+					table[nframes++] = table[j] & PAGE_FRAME;
+				}
+			}
+			frame_decref_batch(table, nframes);
+			ptpool_put(table);
+		}
+	}
+	swap_lock_release();
+	if (as->page_table != NULL) {
+		ptpool_put(as->page_table);
+	}
+
+	unsigned nregions = regionarray_num(&as->regions);
+	for (unsigned i = 0; i < nregions; i++) {
+		struct region *rg = regionarray_get(&as->regions, i);
+		if (rg->r_shared) {
+			/* Exit implies munmap; there's no one to tell if it fails */
+			pcache_writeback(rg->r_vnode, rg->r_foffset,
+					 rg->r_foffset + rg->r_size);
+		}
+		if (rg->r_vnode != NULL) {
+			VOP_DECREF(rg->r_vnode);
+		}
+		kfree(rg);
+	}
+	regionarray_setsize(&as->regions, 0);
+	regionarray_cleanup(&as->regions);
+
+	spinlock_cleanup(&as->pt_lock);
 	kfree(as);
-	as = NULL;
 }
 
-/* Can be directly copied from dumbvm */
+/*
+ * Translations are tagged with the address space's ASID, so there is
+ * no need to flush the TLB; just switch the ASID it matches against.
+ */
 void
 as_activate(void)
 {
-	int i, spl;
 	struct addrspace *as;
 
 	as = proc_getas();
@@ -150,14 +296,7 @@ as_activate(void)
 		return;
 	}
 
-	/* Disable interrupts on this CPU while frobbing the TLB. */
-	spl = splhigh();
-
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
-	}
-
-	splx(spl);
+	tlb_activate(as);
 }
 
 void
@@ -204,20 +343,55 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 	}
 	
 	/* Insert the region into the addrspace */
-	rg->next = as->head;
-	as->head = rg;
+	if (insert_region(as, rg)) {
+		kfree(rg);
+		return ENOMEM;
+	}
 	
 	return 0;
 }
 
+/*
+ * Back the region containing VADDR with FILESIZE bytes of file V from
+ * OFFSET, to appear at VADDR. Pages of the region are read from the
+ * file by vm_fault the first time they are touched; anything past
+ * the end of the file data is zero-filled. The region keeps a
+ * reference to V, so the file stays about after the loader closes it.
+ */
+int
+as_define_file(struct addrspace *as, vaddr_t vaddr, struct vnode *v,
+	       off_t offset, size_t filesize)
+{
+	unsigned nregions = regionarray_num(&as->regions);
+	for (unsigned i = 0; i < nregions; i++) {
+		struct region *rg = regionarray_get(&as->regions, i);
+		if (vaddr < rg->base_addr || vaddr >= rg->base_addr + rg->r_size) {
+			continue;
+		}
+		if (vaddr + filesize > rg->base_addr + rg->r_size) {
+			return EFAULT;
+		}
+
+		VOP_INCREF(v);
+		if (rg->r_vnode != NULL) {
+			VOP_DECREF(rg->r_vnode);
+		}
+		rg->r_vnode = v;
+		rg->r_fvaddr = vaddr;
+		rg->r_foffset = offset;
+		rg->r_filesize = filesize;
+		return 0;
+	}
+	return EFAULT;
+}
+
 int
 as_prepare_load(struct addrspace *as)
 {
 	/* Make readonly regions read/write */
-	struct region *curr = as->head;
-	while (curr != NULL) {
-		curr->write = 1;
-		curr = curr->next;
+	unsigned nregions = regionarray_num(&as->regions);
+	for (unsigned i = 0; i < nregions; i++) {
+		regionarray_get(&as->regions, i)->write = 1;
 	}
 	return 0;
 }
@@ -225,27 +399,334 @@ as_prepare_load(struct addrspace *as)
 int
 as_complete_load(struct addrspace *as)
 {
-	as_activate();
+	vaddr_t heapbase = 0;
 
-	struct region *curr = as->head;
-	while(curr != NULL) {
+	unsigned nregions = regionarray_num(&as->regions);
+	for (unsigned i = 0; i < nregions; i++) {
+		struct region *curr = regionarray_get(&as->regions, i);
+		if (curr->base_addr + curr->r_size > heapbase) {
+			heapbase = curr->base_addr + curr->r_size;
+		}
 		curr->write = curr->ker_write;
-		curr = curr->next;
+
+		/* Take back write access to pages loaded into readonly regions */
+		if (!curr->write) {
+			spinlock_acquire(&as->pt_lock);
+			for (vaddr_t va = curr->base_addr;
+			     va < curr->base_addr + curr->r_size; va += PAGE_SIZE) {
+				paddr_t *pte = lookup_pte(as, va);
+				if (pte != NULL && *pte != NO_ENTRY) {
+					*pte &= ~(TLBLO_DIRTY | PTE_WRITEABLE);
+				}
+			}
+			spinlock_release(&as->pt_lock);
+		}
+	}
+
+	/* Don't leave the loader's writeable translations about */
+	tlb_forget(as);
+	as_activate();
+
+	/* The heap starts out empty, just past the end of the program */
+	struct region *heap = create_region(heapbase, 0, 1, 1, 0);
+	if (heap == NULL) {
+		return ENOMEM;
+	}
+	if (insert_region(as, heap)) {
+		kfree(heap);
+		return ENOMEM;
 	}
+	as->as_heap = heap;
+	as->as_heapend = heapbase;
 
 	return 0;
 }
 
+/*
+ * The stack starts out small and grows downwards as it is faulted on
+ * (see as_growstack), up to as_stackmax. The heap and mappings keep
+ * out of the whole of that, and a guard gap below it, so that running
+ * off the end of the stack faults rather than scribbling on them.
+ */
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
+	struct region *stack;
 
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
 
-	int res = as_define_region(as, *stackptr - PAGE_SIZE * STACK_PAGES, PAGE_SIZE * STACK_PAGES, 1, 1, 0);
+	stack = create_region(USERSTACK - PAGE_SIZE * STACK_INITPAGES,
+			      PAGE_SIZE * STACK_INITPAGES, 1, 1, 0);
+	if (stack == NULL) {
+		return ENOMEM;
+	}
+	if (insert_region(as, stack)) {
+		kfree(stack);
+		return ENOMEM;
+	}
+	as->as_stack = stack;
+	as->as_stackmax = (size_t)stack_maxpages * PAGE_SIZE;
+
+	return 0;
+}
 
-	return res;
+/*
+ * Called by vm_fault for an address in no region. Anything between
+ * the stack and its limit is taken as the stack growing: the region
+ * is extended down to the page (the pages in between are filled in
+ * as they are touched, like any other). The limit was kept clear when
+ * the heap and mappings were placed, but check the guard gap anyway.
+ */
+int
+as_growstack(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *stack = as->as_stack;
+	vaddr_t newbase;
+
+	if (stack == NULL || vaddr >= stack->base_addr ||
+	    vaddr < USERSTACK - as->as_stackmax) {
+		return EFAULT;
+	}
+	newbase = vaddr & PAGE_FRAME;
+
+	unsigned nregions = regionarray_num(&as->regions);
+	for (unsigned i = 0; i < nregions; i++) {
+		struct region *rg = regionarray_get(&as->regions, i);
+		if (rg != stack && rg->base_addr < stack->base_addr &&
+		    rg->base_addr + rg->r_size + STACK_GUARDPAGES * PAGE_SIZE >
+		    newbase) {
+			return EFAULT;
+		}
+	}
+
+	stack->r_size += stack->base_addr - newbase;
+	stack->base_addr = newbase;
+	return 0;
+}
+
+int
+as_setstackmax(unsigned npages)
+{
+	if (npages < STACK_INITPAGES ||
+	    npages > (USERSTACK / 2) / PAGE_SIZE) {
+		return EINVAL;
+	}
+	stack_maxpages = npages;
+	return 0;
+}
+
+unsigned
+as_getstackmax(void)
+{
+	return stack_maxpages;
+}
+
+/*
+ * Where the space above VADDR ends: the base of the next region up,
+ * or for the stack, the bottom of its guard gap. The top of user
+ * space if there is nothing above.
+ */
+static vaddr_t
+next_region(struct addrspace *as, vaddr_t vaddr)
+{
+	vaddr_t limit = MIPS_KSEG0;
+
+	unsigned nregions = regionarray_num(&as->regions);
+	for (unsigned i = 0; i < nregions; i++) {
+		struct region *rg = regionarray_get(&as->regions, i);
+		vaddr_t floor = rg->base_addr;
+		if (rg == as->as_stack) {
+			floor = USERSTACK - as->as_stackmax -
+				STACK_GUARDPAGES * PAGE_SIZE;
+		}
+		if (rg->base_addr > vaddr && floor < limit) {
+			limit = floor;
+		}
+	}
+	return limit;
+}
+
+/*
+ * Move the break. The heap region is the break rounded up to a whole
+ * page, and may grow until it meets the next region up (a mapping, or
+ * the stack's guard gap). Growing only changes the region's size: the
+ * pages are zero-filled by vm_fault as they are touched, so asking for
+ * a lot of heap costs nothing until it is used.
+ */
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
+{
+	struct region *heap = as->as_heap;
+	vaddr_t newend, limit;
+	size_t newsize;
+
+	if (heap == NULL) {
+		return ENOMEM;
+	}
+
+	if (amount < 0) {
+		/* Negating INTPTR_MIN would overflow; this can't */
+		if ((size_t)0 - (size_t)amount >
+		    as->as_heapend - heap->base_addr) {
+			return EINVAL;
+		}
+	}
+	else {
+		limit = next_region(as, heap->base_addr);
+		if (limit < as->as_heapend ||
+		    (size_t)amount > limit - as->as_heapend) {
+			return ENOMEM;
+		}
+	}
+
+	newend = as->as_heapend + amount;
+	newsize = (newend - heap->base_addr + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	if (newsize < heap->r_size) {
+		as_unmap(as, heap->base_addr + newsize,
+			 heap->base_addr + heap->r_size);
+	}
+
+	heap->r_size = newsize;
+	*oldbreak = as->as_heapend;
+	as->as_heapend = newend;
+	return 0;
+}
+
+/*
+ * Map a file. Mappings are stacked downwards from below the stack's
+ * guard gap (or the lowest mapping so far), as far down as the top of
+ * the heap. Pages are read in on first touch, through the page cache,
+ * so every process mapping the same file shares the same frames.
+ */
+int
+as_mmap(struct addrspace *as, struct vnode *v, size_t len, int prot,
+	off_t offset, vaddr_t *addr)
+{
+	struct region *heap = as->as_heap;
+	vaddr_t top, base;
+	size_t size;
+	int result;
+
+	if (len == 0 || offset < 0 || (offset & ~(off_t)PAGE_FRAME) != 0) {
+		return EINVAL;
+	}
+	if (heap == NULL) {
+		return ENOMEM;
+	}
+
+	result = VOP_MMAP(v, offset, len);
+	if (result) {
+		return result;
+	}
+
+	/* Below the lowest region above the heap */
+	top = next_region(as, heap->base_addr);
+	size = (len + PAGE_SIZE - 1) & PAGE_FRAME;
+	if (size < len || top < heap->base_addr + heap->r_size ||
+	    size > top - (heap->base_addr + heap->r_size)) {
+		return ENOMEM;
+	}
+	base = top - size;
+
+	struct region *rg = create_region(base, size, prot & PROT_READ,
+					  prot & PROT_WRITE, 0);
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	rg->r_shared = 1;
+	rg->r_fvaddr = base;
+	rg->r_foffset = offset;
+	if (insert_region(as, rg)) {
+		kfree(rg);
+		return ENOMEM;
+	}
+	VOP_INCREF(v);
+	rg->r_vnode = v;
+
+	*addr = base;
+	return 0;
+}
+
+/*
+ * Remove the mapping at ADDR, then write back what was written to it
+ * (and to the same pages through any other mapping).
+ */
+int
+as_munmap(struct addrspace *as, vaddr_t addr)
+{
+	unsigned nregions = regionarray_num(&as->regions);
+	for (unsigned i = 0; i < nregions; i++) {
+		struct region *rg = regionarray_get(&as->regions, i);
+		if (rg->base_addr != addr || !rg->r_shared) {
+			continue;
+		}
+
+		as_unmap(as, rg->base_addr, rg->base_addr + rg->r_size);
+		regionarray_remove(&as->regions, i);
+		as->last_region = NULL;
+
+		int result = pcache_writeback(rg->r_vnode, rg->r_foffset,
+					      rg->r_foffset + rg->r_size);
+		VOP_DECREF(rg->r_vnode);
+		kfree(rg);
+		return result;
+	}
+	return EINVAL;
+}
+
+/*
+ * Unmap the pages from START to END of the current address space,
+ * freeing their frames and swap slots. Level two tables that don't
+ * exist are skipped whole. The entries are cleared a batch at a time;
+ * the batch's translations are dropped from every TLB by starting the
+ * address space on a new ASID, and then its frames are freed with a
+ * single trip to the frame table. Eviction is held off, as in
+ * as_destroy.
+ */
+#define UNMAP_BATCH 32
+
+static void
+as_unmap(struct addrspace *as, vaddr_t start, vaddr_t end)
+{
+	paddr_t frames[UNMAP_BATCH];
+	unsigned nframes = 0;
+	vaddr_t va = start;
+
+	swap_lock_acquire();
+	while (va < end) {
+		spinlock_acquire(&as->pt_lock);
+		paddr_t *pte = lookup_pte(as, va);
+		if (pte == NULL) {
+			spinlock_release(&as->pt_lock);
+			/* On to the next level two table */
+			va = (va + PAGE_SIZE * PG_TABLE_TWO) &
+				~(vaddr_t)(PAGE_SIZE * PG_TABLE_TWO - 1);
+			continue;
+		}
+		paddr_t entry = *pte;
+		*pte = NO_ENTRY;
+		spinlock_release(&as->pt_lock);
+
+		if (entry & PTE_SWAPPED) {
+			swap_free(PTE_TO_SLOT(entry));
+		}
+		else if (entry != NO_ENTRY) {
+			frames[nframes++] = entry & PAGE_FRAME;
+			if (nframes == UNMAP_BATCH) {
+				tlb_forget(as);
+				frame_decref_batch(frames, nframes);
+				nframes = 0;
+			}
+		}
+		va += PAGE_SIZE;
+	}
+	if (nframes > 0) {
+		tlb_forget(as);
+		frame_decref_batch(frames, nframes);
+	}
+	swap_lock_release();
 }
 
 /* Helper functions to create a new region */
@@ -260,6 +741,33 @@ struct region *create_region(vaddr_t vaddr, size_t memsize, int readable, int wr
 	rg->write = writeable;
 	rg->exec = executable;
 	rg->ker_write = writeable;
-	rg->next = NULL;
+	rg->r_vnode = NULL;
+	rg->r_fvaddr = vaddr;
+	rg->r_foffset = 0;
+	rg->r_filesize = 0;
+	rg->r_shared = 0;
 	return rg;
+}
+
+/*
+ * Insert a region into the address space's region array, keeping it
+ * sorted by base address so lookups can binary search it.
+ */
+static int insert_region(struct addrspace *as, struct region *rg) {
+	unsigned n = regionarray_num(&as->regions);
+
+	int result = regionarray_setsize(&as->regions, n + 1);
+	if (result) {
+		return result;
+	}
+
+	/* Slide bigger regions up one to open a gap */
+	unsigned i = n;
+	while (i > 0 && regionarray_get(&as->regions, i - 1)->base_addr > rg->base_addr) {
+		regionarray_set(&as->regions, i, regionarray_get(&as->regions, i - 1));
+		i--;
+	}
+	regionarray_set(&as->regions, i, rg);
+
+	return 0;
 }
\ No newline at end of file
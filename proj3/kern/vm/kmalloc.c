@@ -242,7 +242,7 @@ allocpagerefpage(struct kheap_root *root)
 		spinlock_release(&kmalloc_spinlock);
 		free_kpages(va);
 		spinlock_acquire(&kmalloc_spinlock);
-		/* Once allocated it isn't ever freed. */
+		/* It isn't freed while any of its pagerefs are in use. */
 		KASSERT(root->page != NULL);
 		return;
 	}
@@ -336,6 +336,42 @@ freepageref(struct pageref *p)
 	KASSERT(0);
 }
 
+/*
+ * Give back pages of pagerefs that are no longer in use, which are
+ * otherwise kept once allocated. Called by the reclaim code when
+ * memory is short; returns the number of pages freed.
+ */
+unsigned
+kheap_shrink(unsigned npages)
+{
+	unsigned whichroot, freed;
+	struct kheap_root *root;
+	vaddr_t va;
+
+	freed = 0;
+	spinlock_acquire(&kmalloc_spinlock);
+	for (whichroot=0; whichroot < NUM_PAGEREFPAGES; whichroot++) {
+		if (freed == npages) {
+			break;
+		}
+		root = &kheaproots[whichroot];
+		if (root->page == NULL || root->numinuse > 0) {
+			continue;
+		}
+		va = (vaddr_t)root->page;
+		root->page = NULL;
+
+		/* Call free_kpages without kmalloc_spinlock. */
+		spinlock_release(&kmalloc_spinlock);
+		free_kpages(va);
+		freed++;
+		spinlock_acquire(&kmalloc_spinlock);
+	}
+	spinlock_release(&kmalloc_spinlock);
+
+	return freed;
+}
+
 ////////////////////////////////////////
 
 /*
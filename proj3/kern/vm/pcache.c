@@ -0,0 +1,430 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Page cache for shared file pages. See pcache.h.
+ */
+
+#include <types.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <vnode.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <reclaim.h>
+#include <pcache.h>
+
+#define PCACHE_BUCKETS 128
+
+struct pcache_page {
+	struct vnode *pp_vnode;
+	off_t pp_offset;
+	paddr_t pp_frame;
+	bool pp_dirty;			/* written since last written back */
+	struct pcache_page *pp_next;
+};
+
+/* Hash chains and statistics, protected by pcache_spinlock */
+static struct spinlock pcache_spinlock = SPINLOCK_INITIALIZER;
+static struct pcache_page *pcache_table[PCACHE_BUCKETS];
+static unsigned pcache_npages;
+static unsigned pcache_ndirty;
+static unsigned pcache_hand;		/* next bucket for the shrinker */
+static uint32_t pcache_hits;
+static uint32_t pcache_misses;
+static uint32_t pcache_dropped;
+static uint32_t pcache_writebacks;
+
+static
+unsigned
+pcache_hash(struct vnode *v, off_t offset)
+{
+	uint32_t h;
+
+	h = (uint32_t)v / sizeof(void *);
+	h ^= (uint32_t)(offset / PAGE_SIZE) * 2654435761U;
+	return h % PCACHE_BUCKETS;
+}
+
+/*
+ * Find the entry for (V, OFFSET), or NULL. Call with the lock held.
+ */
+static
+struct pcache_page *
+pcache_find(struct vnode *v, off_t offset)
+{
+	struct pcache_page *pp;
+
+	for (pp = pcache_table[pcache_hash(v, offset)]; pp != NULL;
+	     pp = pp->pp_next) {
+		if (pp->pp_vnode == v && pp->pp_offset == offset) {
+			return pp;
+		}
+	}
+	return NULL;
+}
+
+paddr_t
+pcache_lookup(struct vnode *v, off_t offset)
+{
+	struct pcache_page *pp;
+	paddr_t frame = 0;
+
+	spinlock_acquire(&pcache_spinlock);
+	pp = pcache_find(v, offset);
+	if (pp != NULL) {
+		frame = pp->pp_frame;
+		frame_incref(frame);
+		pcache_hits++;
+	}
+	else {
+		pcache_misses++;
+	}
+	spinlock_release(&pcache_spinlock);
+
+	return frame;
+}
+
+paddr_t
+pcache_insert(struct vnode *v, off_t offset, paddr_t frame)
+{
+	struct pcache_page *pp, *old;
+	unsigned b;
+
+	KASSERT((offset & ~(off_t)PAGE_FRAME) == 0);
+
+	pp = kmalloc(sizeof(*pp));
+	if (pp == NULL) {
+		return 0;
+	}
+	pp->pp_vnode = v;
+	pp->pp_offset = offset;
+	pp->pp_frame = frame;
+	pp->pp_dirty = false;
+
+	spinlock_acquire(&pcache_spinlock);
+	old = pcache_find(v, offset);
+	if (old != NULL) {
+		/* Someone else read the same page in meanwhile */
+		paddr_t cached = old->pp_frame;
+
+		frame_incref(cached);
+		spinlock_release(&pcache_spinlock);
+		kfree(pp);
+		frame_decref(frame);
+		return cached;
+	}
+	b = pcache_hash(v, offset);
+	pp->pp_next = pcache_table[b];
+	pcache_table[b] = pp;
+	pcache_npages++;
+	frame_incref(frame);
+	spinlock_release(&pcache_spinlock);
+
+	return frame;
+}
+
+void
+pcache_setdirty(struct vnode *v, off_t offset)
+{
+	struct pcache_page *pp;
+
+	spinlock_acquire(&pcache_spinlock);
+	pp = pcache_find(v, offset);
+	KASSERT(pp != NULL);
+	if (!pp->pp_dirty) {
+		pp->pp_dirty = true;
+		pcache_ndirty++;
+	}
+	spinlock_release(&pcache_spinlock);
+}
+
+/*
+ * Each page is looked up by offset, so the lock can be let go for the
+ * write. The page is marked clean before it is written, not after, so
+ * that a write to it by someone mapping it in meanwhile isn't lost;
+ * that isn't possible while it is still mapped, so then it stays
+ * dirty. The frame is held so the shrinker can't free it mid-write.
+ * Nothing past the end of the file is written, so the file doesn't
+ * grow by way of a mapping.
+ */
+int
+pcache_writeback(struct vnode *v, off_t start, off_t end)
+{
+	struct pcache_page *pp;
+	struct stat st;
+	struct iovec iov;
+	struct uio u;
+	paddr_t frame;
+	off_t offset;
+	size_t len;
+	int result;
+
+	if (pcache_ndirty == 0) {
+		/* Unlocked, but nothing can be dirty that we need to see */
+		return 0;
+	}
+
+	result = VOP_STAT(v, &st);
+	if (result) {
+		return result;
+	}
+	if (end > st.st_size) {
+		end = st.st_size;
+	}
+
+	for (offset = start; offset < end; offset += PAGE_SIZE) {
+		spinlock_acquire(&pcache_spinlock);
+		pp = pcache_find(v, offset);
+		if (pp == NULL || !pp->pp_dirty) {
+			spinlock_release(&pcache_spinlock);
+			continue;
+		}
+		frame = pp->pp_frame;
+		if (frame_getref(frame) == 1) {
+			pp->pp_dirty = false;
+			pcache_ndirty--;
+		}
+		frame_incref(frame);
+		pcache_writebacks++;
+		spinlock_release(&pcache_spinlock);
+
+		len = end - offset < PAGE_SIZE ? end - offset : PAGE_SIZE;
+		uio_kinit(&iov, &u, (void *)PADDR_TO_KVADDR(frame), len,
+			  offset, UIO_WRITE);
+		result = VOP_WRITE(v, &u);
+		frame_decref(frame);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Only the part of each page that was written is read back, so that
+ * stores made through a mapping elsewhere in the page since it was
+ * last written back aren't lost; if the page is dirty it stays so.
+ */
+int
+pcache_update(struct vnode *v, off_t start, off_t end)
+{
+	struct pcache_page *pp;
+	struct iovec iov;
+	struct uio u;
+	paddr_t frame;
+	off_t offset, from, to;
+	int result;
+
+	if (pcache_npages == 0) {
+		/* Unlocked; a page read in now sees the new data anyway */
+		return 0;
+	}
+
+	for (offset = start & PAGE_FRAME; offset < end; offset += PAGE_SIZE) {
+		spinlock_acquire(&pcache_spinlock);
+		pp = pcache_find(v, offset);
+		if (pp == NULL) {
+			spinlock_release(&pcache_spinlock);
+			continue;
+		}
+		frame = pp->pp_frame;
+		frame_incref(frame);
+		spinlock_release(&pcache_spinlock);
+
+		from = offset < start ? start : offset;
+		to = offset + PAGE_SIZE < end ? offset + PAGE_SIZE : end;
+		uio_kinit(&iov, &u,
+			  (char *)PADDR_TO_KVADDR(frame) + (from - offset),
+			  to - from, from, UIO_READ);
+		result = VOP_READ(v, &u);
+		frame_decref(frame);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * A page past the end that something still maps is kept, but zeroed,
+ * so that if the file grows again the mapping sees the zeroes the file
+ * does rather than what was there before. Data past the end is never
+ * written back, so a dirty page past the end can just be dropped.
+ */
+void
+pcache_truncate(struct vnode *v, off_t len)
+{
+	struct pcache_page **pq, *pp;
+	unsigned b;
+	size_t keep;
+
+	spinlock_acquire(&pcache_spinlock);
+	for (b = 0; b < PCACHE_BUCKETS; b++) {
+		pq = &pcache_table[b];
+		while ((pp = *pq) != NULL) {
+			if (pp->pp_vnode != v ||
+			    pp->pp_offset + PAGE_SIZE <= len) {
+				pq = &pp->pp_next;
+				continue;
+			}
+			if (pp->pp_offset < len ||
+			    frame_getref(pp->pp_frame) > 1) {
+				keep = pp->pp_offset < len ?
+					len - pp->pp_offset : 0;
+				bzero((char *)PADDR_TO_KVADDR(pp->pp_frame)
+				      + keep, PAGE_SIZE - keep);
+				pq = &pp->pp_next;
+				continue;
+			}
+			*pq = pp->pp_next;
+			pcache_npages--;
+			if (pp->pp_dirty) {
+				pcache_ndirty--;
+			}
+
+			/* As in pcache_shrink, nobody can find it now */
+			spinlock_release(&pcache_spinlock);
+			frame_decref(pp->pp_frame);
+			kfree(pp);
+			spinlock_acquire(&pcache_spinlock);
+			pq = &pcache_table[b];
+		}
+	}
+	spinlock_release(&pcache_spinlock);
+}
+
+/*
+ * By now nothing maps the file, so the writeback cleans every dirty
+ * page but those past the end of the file, which are never written.
+ */
+void
+pcache_purge(struct vnode *v)
+{
+	struct pcache_page **pq, *pp;
+	unsigned b;
+	int result;
+
+	/* The whole file; pcache_writeback stops at the end of it */
+	result = pcache_writeback(v, 0, (off_t)1 << 62);
+	if (result) {
+		kprintf("pcache: Warning: writeback at reclaim: %s\n",
+			strerror(result));
+	}
+
+	spinlock_acquire(&pcache_spinlock);
+	for (b = 0; b < PCACHE_BUCKETS; b++) {
+		pq = &pcache_table[b];
+		while ((pp = *pq) != NULL) {
+			if (pp->pp_vnode != v) {
+				pq = &pp->pp_next;
+				continue;
+			}
+			*pq = pp->pp_next;
+			pcache_npages--;
+			if (pp->pp_dirty) {
+				pcache_ndirty--;
+			}
+
+			/* Give up the lock to free, then rescan the chain */
+			spinlock_release(&pcache_spinlock);
+			frame_decref(pp->pp_frame);
+			kfree(pp);
+			spinlock_acquire(&pcache_spinlock);
+			pq = &pcache_table[b];
+		}
+	}
+	spinlock_release(&pcache_spinlock);
+}
+
+/*
+ * Shrinker: drop clean pages that only the cache still holds, sweeping the
+ * buckets round from where the last call left off.
+ */
+static
+unsigned
+pcache_shrink(unsigned nframes)
+{
+	struct pcache_page **pq, *pp;
+	unsigned n = 0, scanned;
+
+	spinlock_acquire(&pcache_spinlock);
+	for (scanned = 0; scanned < PCACHE_BUCKETS && n < nframes; scanned++) {
+		pq = &pcache_table[pcache_hand];
+		while ((pp = *pq) != NULL && n < nframes) {
+			if (pp->pp_dirty || frame_getref(pp->pp_frame) > 1) {
+				pq = &pp->pp_next;
+				continue;
+			}
+			*pq = pp->pp_next;
+			pcache_npages--;
+			pcache_dropped++;
+			n++;
+
+			/*
+			 * Nothing maps the frame and it is no longer
+			 * findable, so nobody can take a reference to
+			 * it while the lock is let go.
+			 */
+			spinlock_release(&pcache_spinlock);
+			frame_decref(pp->pp_frame);
+			kfree(pp);
+			spinlock_acquire(&pcache_spinlock);
+			pq = &pcache_table[pcache_hand];
+		}
+		pcache_hand = (pcache_hand + 1) % PCACHE_BUCKETS;
+	}
+	spinlock_release(&pcache_spinlock);
+
+	return n;
+}
+
+static struct shrinker pcache_shrinker = {
+	.sh_name = "pcache",
+	.sh_shrink = pcache_shrink,
+};
+
+void
+pcache_bootstrap(void)
+{
+	reclaim_register(&pcache_shrinker);
+}
+
+void
+pcache_printstats(void)
+{
+	uint32_t lookups = pcache_hits + pcache_misses;
+
+	kprintf("pcache: %u pages cached (%u dirty), %u hits of %u lookups "
+		"(%u%%), %u dropped, %u written back\n",
+		pcache_npages, pcache_ndirty, pcache_hits, lookups,
+		lookups ? pcache_hits * 100 / lookups : 0, pcache_dropped,
+		pcache_writebacks);
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Pool of empty page table pages. See ptpool.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <reclaim.h>
+#include <ptpool.h>
+
+#define PTPOOL_SIZE	16	/* pages kept when nothing needs them */
+
+/* The pool and statistics, protected by ptpool_spinlock */
+static struct spinlock ptpool_spinlock = SPINLOCK_INITIALIZER;
+static vaddr_t ptpool_pages[PTPOOL_SIZE];
+static unsigned ptpool_count;
+static unsigned ptpool_inuse;
+static uint32_t ptpool_hits;
+static uint32_t ptpool_misses;
+
+void *
+ptpool_get(void)
+{
+	vaddr_t va = 0;
+
+	spinlock_acquire(&ptpool_spinlock);
+	if (ptpool_count > 0) {
+		va = ptpool_pages[--ptpool_count];
+		ptpool_hits++;
+	}
+	else {
+		ptpool_misses++;
+	}
+	spinlock_release(&ptpool_spinlock);
+
+	if (va == 0) {
+		va = alloc_kpages(1);
+		if (va == 0) {
+			return NULL;
+		}
+		/* An empty entry and a missing table are both all zeroes */
+		KASSERT(NO_ENTRY == 0);
+		bzero((void *)va, PAGE_SIZE);
+	}
+
+	spinlock_acquire(&ptpool_spinlock);
+	ptpool_inuse++;
+	spinlock_release(&ptpool_spinlock);
+
+	return (void *)va;
+}
+
+void
+ptpool_put(void *page)
+{
+	vaddr_t va = (vaddr_t)page;
+	bool keep;
+
+	spinlock_acquire(&ptpool_spinlock);
+	KASSERT(ptpool_inuse > 0);
+	ptpool_inuse--;
+	keep = ptpool_count < PTPOOL_SIZE;
+	spinlock_release(&ptpool_spinlock);
+
+	if (!keep) {
+		free_kpages(va);
+		return;
+	}
+
+	bzero(page, PAGE_SIZE);
+
+	spinlock_acquire(&ptpool_spinlock);
+	if (ptpool_count < PTPOOL_SIZE) {
+		ptpool_pages[ptpool_count++] = va;
+		va = 0;
+	}
+	spinlock_release(&ptpool_spinlock);
+
+	if (va != 0) {
+		/* Someone else filled the pool meanwhile */
+		free_kpages(va);
+	}
+}
+
+/*
+ * Shrinker: give pooled pages back.
+ */
+static
+unsigned
+ptpool_shrink(unsigned nframes)
+{
+	vaddr_t va;
+	unsigned n;
+
+	for (n = 0; n < nframes; n++) {
+		spinlock_acquire(&ptpool_spinlock);
+		if (ptpool_count == 0) {
+			spinlock_release(&ptpool_spinlock);
+			break;
+		}
+		va = ptpool_pages[--ptpool_count];
+		spinlock_release(&ptpool_spinlock);
+
+		free_kpages(va);
+	}
+	return n;
+}
+
+static struct shrinker ptpool_shrinker = {
+	.sh_name = "ptpool",
+	.sh_shrink = ptpool_shrink,
+};
+
+void
+ptpool_bootstrap(void)
+{
+	reclaim_register(&ptpool_shrinker);
+}
+
+void
+ptpool_printstats(void)
+{
+	uint32_t gets = ptpool_hits + ptpool_misses;
+
+	kprintf("ptpool: %u page table pages in use, %u of %u pooled, "
+		"%u of %u taken from the pool (%u%%)\n",
+		ptpool_inuse, ptpool_count, PTPOOL_SIZE,
+		ptpool_hits, gets, gets ? ptpool_hits * 100 / gets : 0);
+}
@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Memory reclaim: shrinker registry, free frame watermarks and the
+ * reclaim thread. See reclaim.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <thread.h>
+#include <current.h>
+#include <cpu.h>
+#include <vm.h>
+#include <reclaim.h>
+
+#define RECLAIM_MAXSHRINKERS 8
+
+/* Registry and statistics, protected by reclaim_spinlock */
+static struct spinlock reclaim_spinlock = SPINLOCK_INITIALIZER;
+static struct shrinker *shrinkers[RECLAIM_MAXSHRINKERS];
+static unsigned nshrinkers;
+static uint32_t reclaim_wakeups;
+static uint32_t reclaim_syncs;
+static uint32_t reclaim_syncfails;
+
+/* Watermarks, in frames */
+static unsigned reclaim_low;
+static unsigned reclaim_high;
+
+/* The reclaim thread sleeps on this; NULL until it is started */
+static struct semaphore *reclaim_sem;
+static volatile bool reclaim_kicked;
+
+/* Kernel heap pages that only hold unused pagerefs */
+static struct shrinker kheap_shrinker = {
+	.sh_name = "kheap",
+	.sh_shrink = kheap_shrink,
+};
+
+void
+reclaim_register(struct shrinker *sh)
+{
+	spinlock_acquire(&reclaim_spinlock);
+	if (nshrinkers == RECLAIM_MAXSHRINKERS) {
+		panic("reclaim_register: Too many shrinkers\n");
+	}
+	sh->sh_calls = 0;
+	sh->sh_freed = 0;
+	shrinkers[nshrinkers++] = sh;
+	spinlock_release(&reclaim_spinlock);
+}
+
+/*
+ * Call one shrinker and count what it did.
+ */
+static
+unsigned
+call_shrinker(struct shrinker *sh, unsigned want)
+{
+	unsigned got;
+
+	got = sh->sh_shrink(want);
+
+	spinlock_acquire(&reclaim_spinlock);
+	sh->sh_calls++;
+	sh->sh_freed += got;
+	spinlock_release(&reclaim_spinlock);
+
+	return got;
+}
+
+/*
+ * Ask each shrinker in turn for what is still wanted, until WANT
+ * frames have been freed or we run out of shrinkers.
+ */
+static
+unsigned
+run_shrinkers(unsigned want)
+{
+	unsigned i, n, freed;
+
+	KASSERT(!curthread->t_reclaiming);
+	curthread->t_reclaiming = true;
+
+	/* Registered entries never change, only get added to */
+	spinlock_acquire(&reclaim_spinlock);
+	n = nshrinkers;
+	spinlock_release(&reclaim_spinlock);
+
+	freed = 0;
+	for (i = 0; i < n && freed < want; i++) {
+		freed += call_shrinker(shrinkers[i], want - freed);
+	}
+
+	curthread->t_reclaiming = false;
+	return freed;
+}
+
+/*
+ * The reclaim thread. Sleeps until poked, then shrinks until the
+ * high watermark is reached or nothing more can be freed.
+ */
+static
+void
+reclaim_thread(void *unused1, unsigned long unused2)
+{
+	unsigned nfree;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		P(reclaim_sem);
+		reclaim_kicked = false;
+
+		spinlock_acquire(&reclaim_spinlock);
+		reclaim_wakeups++;
+		spinlock_release(&reclaim_spinlock);
+
+		nfree = frame_nfree();
+		while (nfree < reclaim_high) {
+			if (run_shrinkers(reclaim_high - nfree) == 0) {
+				break;
+			}
+			nfree = frame_nfree();
+		}
+	}
+}
+
+void
+reclaim_bootstrap(void)
+{
+	int result;
+
+	/* Defaults: start at 1/32 of free memory, stop at twice that */
+	reclaim_low = frame_nfree() / 32;
+	if (reclaim_low < 8) {
+		reclaim_low = 8;
+	}
+	reclaim_high = 2 * reclaim_low;
+
+	reclaim_register(&kheap_shrinker);
+
+	reclaim_sem = sem_create("reclaim", 0);
+	if (reclaim_sem == NULL) {
+		panic("reclaim_bootstrap: Out of memory\n");
+	}
+
+	result = thread_fork("reclaim", NULL, reclaim_thread, NULL, 0);
+	if (result) {
+		panic("reclaim_bootstrap: thread_fork: %s\n", strerror(result));
+	}
+}
+
+/*
+ * Called by the frame allocator after each allocation. This has to be
+ * cheap, and safe to call from anywhere kmalloc can be.
+ */
+void
+reclaim_poke(unsigned nfree)
+{
+	if (reclaim_sem == NULL || nfree >= reclaim_low || reclaim_kicked) {
+		return;
+	}
+	reclaim_kicked = true;
+	V(reclaim_sem);
+}
+
+/*
+ * Reclaim on behalf of an allocation that has failed. Shrinkers may
+ * sleep, so this does nothing in interrupt handlers, with spinlocks
+ * held or interrupts off, or from inside a shrinker.
+ */
+unsigned
+reclaim_sync(unsigned nframes)
+{
+	unsigned freed;
+
+	if (reclaim_sem == NULL || curthread->t_in_interrupt ||
+	    curthread->t_reclaiming || curthread->t_curspl != 0 ||
+	    curcpu->c_spinlocks != 0) {
+		return 0;
+	}
+
+	freed = run_shrinkers(nframes);
+
+	spinlock_acquire(&reclaim_spinlock);
+	reclaim_syncs++;
+	if (freed == 0) {
+		reclaim_syncfails++;
+	}
+	spinlock_release(&reclaim_spinlock);
+
+	return freed;
+}
+
+int
+reclaim_setwatermarks(unsigned low, unsigned high)
+{
+	if (low == 0 || high <= low) {
+		return EINVAL;
+	}
+	reclaim_low = low;
+	reclaim_high = high;
+	reclaim_poke(frame_nfree());
+	return 0;
+}
+
+unsigned
+reclaim_lowwater(void)
+{
+	return reclaim_low;
+}
+
+/*
+ * Go round until a whole pass frees nothing, since one shrinker
+ * giving up memory can leave another with more to give: emptying a
+ * cache can leave kernel heap pages with nothing in them, say.
+ */
+unsigned
+reclaim_dropcaches(void)
+{
+	unsigned i, n, got, freed;
+
+	KASSERT(!curthread->t_reclaiming);
+	curthread->t_reclaiming = true;
+
+	spinlock_acquire(&reclaim_spinlock);
+	n = nshrinkers;
+	spinlock_release(&reclaim_spinlock);
+
+	freed = 0;
+	do {
+		got = 0;
+		for (i = 0; i < n; i++) {
+			if (!shrinkers[i]->sh_evicts) {
+				got += call_shrinker(shrinkers[i], (unsigned)-1);
+			}
+		}
+		freed += got;
+	} while (got > 0);
+
+	curthread->t_reclaiming = false;
+	return freed;
+}
+
+void
+reclaim_printstats(void)
+{
+	unsigned i, n;
+
+	kprintf("Reclaim: low watermark %u, high watermark %u, "
+		"%u frames free\n", reclaim_low, reclaim_high, frame_nfree());
+	kprintf("    %u reclaim thread wakeups, %u synchronous reclaims "
+		"(%u freed nothing)\n",
+		reclaim_wakeups, reclaim_syncs, reclaim_syncfails);
+
+	/* Counters are read unlocked; they are only for show */
+	spinlock_acquire(&reclaim_spinlock);
+	n = nshrinkers;
+	spinlock_release(&reclaim_spinlock);
+	for (i = 0; i < n; i++) {
+		kprintf("    %-8s %u calls, %u frames freed\n",
+			shrinkers[i]->sh_name, shrinkers[i]->sh_calls,
+			shrinkers[i]->sh_freed);
+	}
+}
@@ -0,0 +1,408 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Swap space.
+ *
+ * The swap device is divided into page-sized slots, with a bitmap of
+ * the ones in use and a reference count for each. Frames are chosen
+ * for eviction by the clock algorithm in the frame table, which only
+ * offers up frames mapped by exactly one page table.
+ *
+ * Locking: swap_lock is held across every eviction and page-in, which
+ * keeps the swap I/O in order (a page can't be read back before it has
+ * finished being written) and keeps address spaces from being torn
+ * down underneath the clock hand. Under it, a page table's pt_lock is
+ * taken to change an entry, then the frame table lock. Nothing sleeps
+ * or allocates memory while holding pt_lock.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <cpu.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <swap.h>
+#include <reclaim.h>
+
+/* The most slots a page table entry can name */
+#define SWAP_MAXSLOTS   (1 << 20)
+
+/* Victims to try before giving up on eviction */
+#define SWAP_EVICT_TRIES 16
+
+static struct lock *swap_lock;
+static struct semaphore *swap_shootdown_sem;
+
+static struct vnode *swap_vnode;
+static unsigned swap_nslots;
+
+/* Slot allocation state, protected by swap_slot_lock */
+static struct spinlock swap_slot_lock = SPINLOCK_INITIALIZER;
+static struct bitmap *swap_map;
+static uint16_t *swap_refs;
+static unsigned swap_used;
+
+/* Statistics */
+static uint32_t swap_pageins;
+static uint32_t swap_pageouts;
+
+/*
+ * Shrinker: evict up to NFRAMES pages.
+ */
+static
+unsigned
+swap_shrink(unsigned nframes)
+{
+	unsigned n;
+
+	for (n = 0; n < nframes; n++) {
+		if (swap_evict()) {
+			break;
+		}
+	}
+	return n;
+}
+
+static struct shrinker swap_shrinker = {
+	.sh_name = "swap",
+	.sh_shrink = swap_shrink,
+	.sh_evicts = true,
+};
+
+void
+swap_bootstrap(void)
+{
+	swap_lock = lock_create("swap");
+	if (swap_lock == NULL) {
+		panic("swap_bootstrap: Out of memory\n");
+	}
+	swap_shootdown_sem = sem_create("swap shootdown", 0);
+	if (swap_shootdown_sem == NULL) {
+		panic("swap_bootstrap: Out of memory\n");
+	}
+}
+
+/*
+ * Start swapping to DEVNAME. Swap can be turned on only once.
+ */
+int
+swap_on(const char *devname)
+{
+	struct vnode *vn;
+	struct bitmap *map;
+	uint16_t *refs;
+	struct stat st;
+	unsigned nslots;
+	int result;
+
+	if (swap_vnode != NULL) {
+		return EBUSY;
+	}
+
+	result = vfs_swapon(devname, &vn);
+	if (result) {
+		return result;
+	}
+
+	result = VOP_STAT(vn, &st);
+	if (result) {
+		vfs_swapoff(devname);
+		return result;
+	}
+
+	nslots = st.st_size / PAGE_SIZE;
+	if (nslots > SWAP_MAXSLOTS) {
+		nslots = SWAP_MAXSLOTS;
+	}
+	if (nslots == 0) {
+		vfs_swapoff(devname);
+		return ENOSPC;
+	}
+
+	map = bitmap_create(nslots);
+	refs = kmalloc(nslots * sizeof(uint16_t));
+	if (map == NULL || refs == NULL) {
+		if (map != NULL) {
+			bitmap_destroy(map);
+		}
+		kfree(refs);
+		vfs_swapoff(devname);
+		return ENOMEM;
+	}
+
+	lock_acquire(swap_lock);
+	swap_map = map;
+	swap_refs = refs;
+	swap_nslots = nslots;
+	swap_vnode = vn;
+	lock_release(swap_lock);
+
+	reclaim_register(&swap_shrinker);
+
+	kprintf("swap: %s: %u pages\n", devname, nslots);
+	return 0;
+}
+
+static
+int
+swap_alloc(unsigned *slot)
+{
+	int result;
+
+	spinlock_acquire(&swap_slot_lock);
+	result = bitmap_alloc(swap_map, slot);
+	if (result == 0) {
+		swap_refs[*slot] = 1;
+		swap_used++;
+	}
+	spinlock_release(&swap_slot_lock);
+	return result;
+}
+
+void
+swap_dup(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_slot_lock);
+	KASSERT(swap_refs[slot] > 0 && swap_refs[slot] < 0xffff);
+	swap_refs[slot]++;
+	spinlock_release(&swap_slot_lock);
+}
+
+void
+swap_free(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_slot_lock);
+	KASSERT(swap_refs[slot] > 0);
+	if (--swap_refs[slot] == 0) {
+		bitmap_unmark(swap_map, slot);
+		swap_used--;
+	}
+	spinlock_release(&swap_slot_lock);
+}
+
+/*
+ * Move one page between a frame and a slot.
+ */
+static
+int
+swap_io(unsigned slot, paddr_t frame, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(frame), PAGE_SIZE,
+		  (off_t)slot * PAGE_SIZE, rw);
+	if (rw == UIO_READ) {
+		result = VOP_READ(swap_vnode, &ku);
+	}
+	else {
+		result = VOP_WRITE(swap_vnode, &ku);
+	}
+	if (result == 0 && ku.uio_resid != 0) {
+		result = EIO;
+	}
+	return result;
+}
+
+/*
+ * Make sure no other cpu still has VADDR of AS mapped in its TLB. We do
+ * our own TLB before calling this.
+ */
+static
+void
+swap_shootdown(struct addrspace *as, vaddr_t vaddr)
+{
+	struct tlbshootdown ts;
+	unsigned n;
+
+	ts.ts_as = as;
+	ts.ts_vaddr = vaddr;
+	ts.ts_done = swap_shootdown_sem;
+	n = ipi_tlbshootdown_broadcast(&ts);
+	while (n-- > 0) {
+		P(swap_shootdown_sem);
+	}
+}
+
+int
+swap_evict(void)
+{
+	struct addrspace *as;
+	vaddr_t vaddr;
+	paddr_t frame, old, *pte;
+	unsigned slot, tries;
+	int result;
+
+	/* Swap I/O may allocate; don't go round in circles */
+	if (swap_vnode == NULL || lock_do_i_hold(swap_lock)) {
+		return ENOMEM;
+	}
+
+	lock_acquire(swap_lock);
+	if (swap_alloc(&slot)) {
+		lock_release(swap_lock);
+		return ENOMEM;
+	}
+
+	/*
+	 * The clock hand reads the frame table without looking at page
+	 * tables, so the victim may have been forked or remapped since.
+	 * Check it is still the page it claims to be before taking it.
+	 */
+	pte = NULL;
+	old = NO_ENTRY;
+	for (tries = 0; tries < SWAP_EVICT_TRIES; tries++) {
+		frame = frame_pick_victim(&as, &vaddr);
+		if (frame == 0) {
+			break;
+		}
+
+		spinlock_acquire(&as->pt_lock);
+		pte = lookup_pte(as, vaddr);
+		if (pte != NULL && (*pte & (PAGE_FRAME | PTE_SWAPPED)) == frame &&
+		    frame_getref(frame) == 1) {
+			old = *pte;
+			*pte = SLOT_TO_PTE(slot) |
+				(old & (TLBLO_DIRTY | PTE_WRITEABLE));
+			tlb_invalidate(as, vaddr);
+			spinlock_release(&as->pt_lock);
+			break;
+		}
+		spinlock_release(&as->pt_lock);
+	}
+	if (old == NO_ENTRY) {
+		swap_free(slot);
+		lock_release(swap_lock);
+		return ENOMEM;
+	}
+
+	swap_shootdown(as, vaddr);
+
+	result = swap_io(slot, frame, UIO_WRITE);
+	if (result) {
+		/* Leave the page where it was */
+		spinlock_acquire(&as->pt_lock);
+		*pte = old;
+		spinlock_release(&as->pt_lock);
+		swap_free(slot);
+		lock_release(swap_lock);
+		return result;
+	}
+
+	swap_pageouts++;
+	frame_decref(frame);
+	lock_release(swap_lock);
+	return 0;
+}
+
+/*
+ * Read the page at VADDR back in from swap into FRAME, a newly
+ * allocated frame, and map it. FRAME is used up if this succeeds. If
+ * the page was already brought back (by a failed eviction putting it
+ * back), FRAME is freed and the fault just needs retrying.
+ */
+int
+swap_pagein(struct addrspace *as, vaddr_t vaddr, paddr_t frame)
+{
+	paddr_t entry, *pte;
+	unsigned slot;
+	int result;
+
+	vaddr &= PAGE_FRAME;
+
+	lock_acquire(swap_lock);
+
+	spinlock_acquire(&as->pt_lock);
+	pte = lookup_pte(as, vaddr);
+	KASSERT(pte != NULL);
+	entry = *pte;
+	spinlock_release(&as->pt_lock);
+
+	if (!(entry & PTE_SWAPPED)) {
+		lock_release(swap_lock);
+		free_kpages(PADDR_TO_KVADDR(frame));
+		return 0;
+	}
+
+	slot = PTE_TO_SLOT(entry);
+	result = swap_io(slot, frame, UIO_READ);
+	if (result) {
+		lock_release(swap_lock);
+		return result;
+	}
+
+	spinlock_acquire(&as->pt_lock);
+	*pte = frame | TLBLO_VALID | (entry & (TLBLO_DIRTY | PTE_WRITEABLE));
+	tlb_refill(vaddr, *pte);
+	spinlock_release(&as->pt_lock);
+	frame_set_owner(frame, as, vaddr);
+
+	swap_free(slot);
+	swap_pageins++;
+	lock_release(swap_lock);
+	return 0;
+}
+
+void
+swap_lock_acquire(void)
+{
+	lock_acquire(swap_lock);
+}
+
+void
+swap_lock_release(void)
+{
+	lock_release(swap_lock);
+}
+
+void
+swap_printstats(void)
+{
+	if (swap_vnode == NULL) {
+		kprintf("swap: off\n");
+		return;
+	}
+	kprintf("swap: %u of %u slots in use, %u page-ins, %u page-outs\n",
+		swap_used, swap_nslots, swap_pageins, swap_pageouts);
+}
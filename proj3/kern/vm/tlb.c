@@ -0,0 +1,486 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * TLB management.
+ *
+ * User translations are tagged with an address space ID (the PID field
+ * of EntryHi), so switching address spaces doesn't mean throwing the
+ * whole TLB away. ASIDs are handed out per cpu: each cpu gives them out
+ * in order, and when it runs out it flushes its TLB and starts a new
+ * generation. An address space remembers the ASID (and generation) it
+ * was given on each cpu; one from an old generation is no good and a
+ * new ASID is taken. ASID 0 is never handed out.
+ *
+ * Each cpu also keeps a software TLB: a direct-mapped cache of the
+ * translations it has loaded, tagged the same way. Entries the hardware
+ * TLB throws out to make room are still in the software TLB, and
+ * vm_fault reloads them from there without walking the page table.
+ *
+ * Anything that changes or removes a translation must drop it from
+ * the TLBs. For a single page on this cpu that is tlb_update or
+ * tlb_invalidate (and a shootdown for the others); when a lot of an
+ * address space changes at once, tlb_forget makes it start over with
+ * a new ASID everywhere.
+ *
+ * Which hardware slot a new translation goes in is up to the
+ * replacement policy, chosen with tlb_setpolicy:
+ *
+ *    random - let tlbwr pick (the processor's pseudo-random slot).
+ *    rr     - round robin over the slots.
+ *    lru    - approximate LRU, by the clock algorithm. The hardware
+ *             keeps no reference bits, so they are sampled: when the
+ *             hand passes a referenced entry it clears the bit and
+ *             marks the entry invalid, keeping its page and ASID. If
+ *             the page is used again the access faults, the entry is
+ *             found by tlb_probe and made valid in place, and the bit
+ *             is set again. Entries nobody touched in a full turn of
+ *             the hand get replaced.
+ *
+ * Every load probes first, so an entry invalidated by sampling is
+ * always reused rather than duplicated.
+ *
+ * All of the per-cpu state is only touched on its own cpu with
+ * interrupts off.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <vm.h>
+
+/* Size of each cpu's software TLB (a power of 2) */
+#define STLB_SIZE 128
+
+struct stlb_entry {
+	uint32_t se_hi;		/* EntryHi (page and ASID), 0 if empty */
+	uint32_t se_lo;		/* EntryLo */
+};
+
+#define TLB_NPOLICIES 3
+
+struct tlb_cpu {
+	uint32_t tc_gen;	/* ASID generation, above the ASID bits */
+	uint32_t tc_next;	/* next ASID to hand out */
+	uint32_t tc_asid;	/* ASID now loaded in EntryHi */
+
+	struct stlb_entry tc_stlb[STLB_SIZE];
+
+	/* Replacement state */
+	uint32_t tc_hand;		/* rr and lru: next slot to look at */
+	uint8_t tc_ref[NUM_TLB];	/* lru: slot used since the hand passed */
+
+	/* Statistics */
+	uint32_t tc_stlb_hits;
+	uint32_t tc_asid_allocs;
+	uint32_t tc_rollovers;
+	uint32_t tc_loads[TLB_NPOLICIES];	/* translations loaded on a miss */
+	uint32_t tc_refaults[TLB_NPOLICIES];	/* misses on sampled entries */
+	uint32_t tc_samples[TLB_NPOLICIES];	/* entries sampled */
+};
+
+static struct tlb_cpu tlb_cpus[MAXCPUS];
+
+/*
+ * Replacement policies. tp_victim returns the slot to replace, or -1
+ * to use tlbwr.
+ */
+struct tlb_policy {
+	const char *tp_name;
+	int (*tp_victim)(struct tlb_cpu *tc, unsigned policy);
+};
+
+static
+int
+victim_random(struct tlb_cpu *tc, unsigned policy)
+{
+	(void)tc;
+	(void)policy;
+	return -1;
+}
+
+static
+int
+victim_rr(struct tlb_cpu *tc, unsigned policy)
+{
+	int i = tc->tc_hand;
+
+	(void)policy;
+	tc->tc_hand = (i + 1) % NUM_TLB;
+	return i;
+}
+
+static
+int
+victim_lru(struct tlb_cpu *tc, unsigned policy)
+{
+	uint32_t hi, lo;
+	int i;
+
+	/* After one turn every bit is clear, so this always finds one */
+	while (1) {
+		i = tc->tc_hand;
+		tc->tc_hand = (i + 1) % NUM_TLB;
+		if (!tc->tc_ref[i]) {
+			return i;
+		}
+
+		/* Take a sample: the next use of this entry will fault */
+		tc->tc_ref[i] = 0;
+		tlb_read(&hi, &lo, i);
+		tlb_write(hi, lo & ~TLBLO_VALID, i);
+		tc->tc_samples[policy]++;
+	}
+}
+
+static const struct tlb_policy tlb_policies[TLB_NPOLICIES] = {
+	{ "random", victim_random },
+	{ "rr",     victim_rr },
+	{ "lru",    victim_lru },
+};
+
+static unsigned tlb_policy;	/* index into tlb_policies */
+
+static
+struct stlb_entry *
+stlb_slot(struct tlb_cpu *tc, uint32_t hi)
+{
+	uint32_t n = (hi >> 12) ^ ((hi & TLBHI_PID) >> (TLBHI_PIDSHIFT - 1));
+	return &tc->tc_stlb[n & (STLB_SIZE - 1)];
+}
+
+static
+void
+stlb_clear(struct tlb_cpu *tc)
+{
+	for (int i = 0; i < STLB_SIZE; i++) {
+		tc->tc_stlb[i].se_hi = 0;
+	}
+}
+
+/* EntryHi for a page in the address space loaded on this cpu */
+static
+uint32_t
+tlb_hi(struct tlb_cpu *tc, vaddr_t vaddr)
+{
+	return (vaddr & TLBHI_VPAGE) | (tc->tc_asid << TLBHI_PIDSHIFT);
+}
+
+/*
+ * Make AS the address space the TLB matches user accesses against,
+ * giving it a new ASID on this cpu if it doesn't have a current one.
+ */
+void
+tlb_activate(struct addrspace *as)
+{
+	struct tlb_cpu *tc;
+	uint32_t asid;
+	int spl;
+
+	spl = splhigh();
+	tc = &tlb_cpus[curcpu->c_number];
+	if (tc->tc_gen == 0) {
+		/* First time on this cpu */
+		tc->tc_gen = NUM_ASID;
+		tc->tc_next = 1;
+	}
+
+	asid = as->as_asid[curcpu->c_number];
+	if ((asid & ~(NUM_ASID - 1)) != tc->tc_gen) {
+		if (tc->tc_next == NUM_ASID) {
+			/* Out of ASIDs; everybody starts again */
+			tc->tc_gen += NUM_ASID;
+			if (tc->tc_gen == 0) {
+				tc->tc_gen = NUM_ASID;
+			}
+			tc->tc_next = 1;
+			tc->tc_rollovers++;
+			tlb_flush();
+		}
+		asid = tc->tc_gen | tc->tc_next++;
+		as->as_asid[curcpu->c_number] = asid;
+		tc->tc_asid_allocs++;
+	}
+
+	tc->tc_asid = asid & (NUM_ASID - 1);
+	tlb_setpid(tc->tc_asid << TLBHI_PIDSHIFT);
+	splx(spl);
+}
+
+/*
+ * Throw away AS's translations on every other cpu, by making it take a
+ * new ASID when it next runs there. AS must not be running elsewhere.
+ */
+void
+tlb_forget_remote(struct addrspace *as)
+{
+	for (unsigned i = 0; i < MAXCPUS; i++) {
+		if (i != curcpu->c_number) {
+			as->as_asid[i] = 0;
+		}
+	}
+}
+
+/* Throw away AS's translations everywhere */
+void
+tlb_forget(struct addrspace *as)
+{
+	struct tlb_cpu *tc;
+	uint32_t asid;
+	int spl;
+
+	spl = splhigh();
+	tc = &tlb_cpus[curcpu->c_number];
+	asid = as->as_asid[curcpu->c_number];
+
+	tlb_forget_remote(as);
+	as->as_asid[curcpu->c_number] = 0;
+
+	/* If AS is the one loaded here, it needs a new ASID right away */
+	if ((asid & ~(NUM_ASID - 1)) == tc->tc_gen &&
+	    (asid & (NUM_ASID - 1)) == tc->tc_asid) {
+		tlb_activate(as);
+	}
+	splx(spl);
+}
+
+/*
+ * Put a translation in the TLB. If there is an entry for the page
+ * already (one invalidated for sampling, or one being updated), it is
+ * overwritten; otherwise the policy picks a slot. MISS says whether
+ * this is a refill after a miss, for the statistics.
+ */
+static
+void
+tlb_load(struct tlb_cpu *tc, uint32_t hi, uint32_t lo, bool miss)
+{
+	unsigned policy = tlb_policy;
+	int index;
+
+	index = tlb_probe(hi, 0);
+	if (index >= 0) {
+		if (miss) {
+			tc->tc_refaults[policy]++;
+		}
+	}
+	else {
+		index = tlb_policies[policy].tp_victim(tc, policy);
+	}
+
+	if (index >= 0) {
+		tlb_write(hi, lo, index);
+		tc->tc_ref[index] = 1;
+	}
+	else {
+		tlb_random(hi, lo);
+	}
+	if (miss) {
+		tc->tc_loads[policy]++;
+	}
+
+	stlb_slot(tc, hi)->se_hi = hi;
+	stlb_slot(tc, hi)->se_lo = lo;
+}
+
+/*
+ * Load a translation for the current address space after a miss. Page
+ * table entries can be passed straight in; the software bits are
+ * stripped here.
+ */
+void tlb_refill(uint32_t entryhi, uint32_t entrylo) {
+	struct tlb_cpu *tc;
+	int spl = splhigh();
+
+	tc = &tlb_cpus[curcpu->c_number];
+	tlb_load(tc, tlb_hi(tc, entryhi), entrylo & ~PTE_SOFT_MASK, true);
+	splx(spl);
+}
+
+/* Replace the tlb entry for a page if it is loaded, otherwise load it */
+void tlb_update(uint32_t entryhi, uint32_t entrylo) {
+	struct tlb_cpu *tc;
+	int spl = splhigh();
+
+	tc = &tlb_cpus[curcpu->c_number];
+	tlb_load(tc, tlb_hi(tc, entryhi), entrylo & ~PTE_SOFT_MASK, false);
+	splx(spl);
+}
+
+/*
+ * Try to satisfy a tlb miss from the software TLB. Returns nonzero if
+ * the translation was found (and is writeable, for a write) and has
+ * been loaded.
+ */
+int tlb_reload(vaddr_t vaddr, int write) {
+	struct tlb_cpu *tc;
+	struct stlb_entry *se;
+	uint32_t hi;
+	int spl = splhigh();
+
+	tc = &tlb_cpus[curcpu->c_number];
+	hi = tlb_hi(tc, vaddr);
+	se = stlb_slot(tc, hi);
+	if (se->se_hi != hi || (write && !(se->se_lo & TLBLO_DIRTY))) {
+		splx(spl);
+		return 0;
+	}
+	tlb_load(tc, hi, se->se_lo, true);
+	frame_reference(se->se_lo & PAGE_FRAME);
+	tc->tc_stlb_hits++;
+	splx(spl);
+	return 1;
+}
+
+/*
+ * Drop the translation for a page of AS from this cpu's TLBs, whether
+ * or not AS is the one loaded here.
+ */
+void tlb_invalidate(struct addrspace *as, vaddr_t vaddr) {
+	struct tlb_cpu *tc;
+	struct stlb_entry *se;
+	uint32_t asid, hi;
+	int spl = splhigh();
+
+	tc = &tlb_cpus[curcpu->c_number];
+	asid = as->as_asid[curcpu->c_number];
+	if ((asid & ~(NUM_ASID - 1)) != tc->tc_gen) {
+		/* Nothing of AS's can be in our TLB */
+		splx(spl);
+		return;
+	}
+
+	hi = (vaddr & TLBHI_VPAGE) | ((asid & (NUM_ASID - 1)) << TLBHI_PIDSHIFT);
+	int index = tlb_probe(hi, 0);
+	if (index >= 0) {
+		tlb_write(TLBHI_INVALID(index), TLBLO_INVALID(), index);
+		tc->tc_ref[index] = 0;
+	}
+	se = stlb_slot(tc, hi);
+	if (se->se_hi == hi) {
+		se->se_hi = 0;
+	}
+
+	/* The probe and write clobbered the ASID in EntryHi */
+	tlb_setpid(tc->tc_asid << TLBHI_PIDSHIFT);
+	splx(spl);
+}
+
+/* Invalidate every entry in this cpu's TLBs */
+void tlb_flush(void) {
+	struct tlb_cpu *tc;
+	int spl = splhigh();
+
+	tc = &tlb_cpus[curcpu->c_number];
+	for (int i = 0; i < NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		tc->tc_ref[i] = 0;
+	}
+	stlb_clear(tc);
+	tlb_setpid(tc->tc_asid << TLBHI_PIDSHIFT);
+	splx(spl);
+}
+
+/*
+ * Choose the replacement policy by name. Returns EINVAL if there is no
+ * such policy.
+ */
+int
+tlb_setpolicy(const char *name)
+{
+	for (unsigned i = 0; i < TLB_NPOLICIES; i++) {
+		if (!strcmp(tlb_policies[i].tp_name, name)) {
+			tlb_policy = i;
+			return 0;
+		}
+	}
+	return EINVAL;
+}
+
+/*
+ * Name of the Nth policy, or of the current one if N is -1. Returns
+ * NULL past the last policy.
+ */
+const char *
+tlb_policyname(int n)
+{
+	if (n < 0) {
+		return tlb_policies[tlb_policy].tp_name;
+	}
+	if (n >= TLB_NPOLICIES) {
+		return NULL;
+	}
+	return tlb_policies[n].tp_name;
+}
+
+/* Total translations loaded after misses, on all cpus under any policy */
+uint32_t
+tlb_nloads(void)
+{
+	uint32_t total = 0;
+
+	for (unsigned i = 0; i < MAXCPUS; i++) {
+		for (unsigned p = 0; p < TLB_NPOLICIES; p++) {
+			total += tlb_cpus[i].tc_loads[p];
+		}
+	}
+	return total;
+}
+
+void
+tlb_printstats(void)
+{
+	struct tlb_cpu *tc;
+
+	kprintf("TLB: %u ASIDs, %u-entry software TLB per cpu, "
+		"%s replacement\n", NUM_ASID - 1, STLB_SIZE,
+		tlb_policies[tlb_policy].tp_name);
+	for (unsigned i = 0; i < MAXCPUS; i++) {
+		tc = &tlb_cpus[i];
+		if (tc->tc_gen == 0) {
+			continue;
+		}
+		kprintf("    cpu%u: %u ASIDs handed out, %u rollovers, "
+			"%u software TLB hits\n", i, tc->tc_asid_allocs,
+			tc->tc_rollovers, tc->tc_stlb_hits);
+		for (unsigned p = 0; p < TLB_NPOLICIES; p++) {
+			if (tc->tc_loads[p] == 0) {
+				continue;
+			}
+			kprintf("        %-6s %u loads, %u on sampled entries, "
+				"%u samples\n", tlb_policies[p].tp_name,
+				tc->tc_loads[p], tc->tc_refaults[p],
+				tc->tc_samples[p]);
+		}
+	}
+}
@@ -8,14 +8,37 @@
 #include <spl.h>
 #include <proc.h>
 #include <synch.h>
+#include <clock.h>
+#include <cpu.h>
+#include <current.h>
+#include <platform/maxcpus.h>
+#include <swap.h>
+#include <reclaim.h>
+#include <pcache.h>
+#include <zeropool.h>
+#include <ptpool.h>
+#include <uio.h>
+#include <vnode.h>
 
 /* Page table specific functions */
 int insert_pte(struct addrspace *as, vaddr_t pt_index, paddr_t pt_entry);
 paddr_t get_pte(struct addrspace *as, vaddr_t pt_index);
 
-/* Region specific functions */
-struct region *return_region(struct addrspace *as, vaddr_t faultaddress);
-int validate_region(struct addrspace *as, vaddr_t faultaddress, int faulttype);
+static paddr_t alloc_upage(void);
+static paddr_t alloc_zeroed_upage(void);
+static void free_upage(paddr_t frame);
+static int copy_on_write(struct addrspace *as, vaddr_t faultaddress,
+                         paddr_t *pte, paddr_t entry);
+static int region_fill(struct region *rg, vaddr_t vaddr, paddr_t frame);
+
+/*
+ * The zero page. Reads of anonymous memory that hasn't been written
+ * yet map this one frame, read-only, so untouched memory costs no
+ * more than a page table entry; the first write makes a private copy
+ * through the copy-on-write path. The frame's own reference is never
+ * dropped, so every mapping of it is shared and is copied on write.
+ */
+static paddr_t vm_zeroframe;
 
 void vm_bootstrap(void)
 {
@@ -24,80 +47,784 @@ void vm_bootstrap(void)
      * You may or may not need to add anything here depending what's
      * provided or required by the assignment spec.
      */
+    swap_bootstrap();
+    reclaim_bootstrap();
+    pcache_bootstrap();
+    zeropool_bootstrap();
+    ptpool_bootstrap();
+
+    vm_zeroframe = alloc_upage();
+    if (vm_zeroframe == 0) {
+        panic("vm_bootstrap: Out of memory\n");
+    }
+    bzero((void *) PADDR_TO_KVADDR(vm_zeroframe), PAGE_SIZE);
 }
 
 
+/*
+ * Fault profiling. Every fault is counted by the path that handled it,
+ * and one in VM_PROF_SAMPLE faults is timed, which is enough to see
+ * what each path costs without gettime() dominating the cost of a
+ * refill. The counters are per cpu, so they need no lock.
+ */
+#define VM_PROF_SAMPLE 64
+
+enum vm_fault_path {
+    VMF_STLB,           /* reloaded from the software tlb */
+    VMF_REFILL,         /* resident page, loaded from the page table */
+    VMF_COW,            /* write to a read-only entry */
+    VMF_PAGEIN,         /* brought back in from swap */
+    VMF_ZEROFILL,       /* first touch of an anonymous page */
+    VMF_ZEROPAGE,       /* first read of one, mapped to the zero page */
+    VMF_FILEFILL,       /* first touch of a page backed by a file */
+    VMF_CACHEHIT,       /* first touch of a page already in the page cache */
+    VMF_SHWRITE,        /* first write to a page of a mapped file */
+    VMF_LPFILL,         /* first write to a large page run, all filled */
+    VMF_LPLOAD,         /* page of a large page run, whole run loaded */
+    VMF_FAILED,         /* bad access, or out of memory */
+    VMF_NPATHS
+};
+
+static const char *const vm_fault_pathnames[VMF_NPATHS] = {
+    "stlb", "refill", "cow", "pagein", "zerofill", "zeropage", "filefill",
+    "cachehit", "shwrite", "lpfill", "lpload", "failed",
+};
+
+struct vm_prof {
+    uint32_t vp_faults;                 /* faults seen, for sampling */
+    uint32_t vp_count[VMF_NPATHS];      /* faults handled by each path */
+    uint32_t vp_samples[VMF_NPATHS];    /* of those, how many were timed */
+    uint64_t vp_nsecs[VMF_NPATHS];      /* total time of the timed ones */
+    uint32_t vp_around_loads;           /* neighbours loaded into the tlb */
+    uint32_t vp_around_fills;           /* of those, first touched */
+    uint32_t vp_lpage_loads;            /* large page neighbours loaded */
+};
+
+static struct vm_prof vm_prof[MAXCPUS];
+
+/*
+ * Fault-around: how many pages after a faulting page to map at the
+ * same time. See fault_around.
+ */
+static unsigned vm_faultaround = FAULTAROUND_DEFAULT;
+
+static int vm_fault_path(int faulttype, vaddr_t faultaddress,
+                         enum vm_fault_path *path);
+static int cached_fault(struct addrspace *as, struct region *rg,
+                        vaddr_t vaddr, int faulttype,
+                        enum vm_fault_path *path);
+static int shared_write(struct addrspace *as, vaddr_t faultaddress,
+                        paddr_t *pte, paddr_t entry);
+static int fill_page(struct addrspace *as, struct region *rg, vaddr_t vaddr,
+                     int faulttype, enum vm_fault_path *path);
+static void fault_around(vaddr_t faultaddress, bool fill);
+static int fill_lpage(struct addrspace *as, struct region *rg, vaddr_t vaddr);
+static void lpage_preload(struct addrspace *as, vaddr_t vaddr, paddr_t entry);
+
+#define LPAGE_SIZE (LPAGE_PAGES * PAGE_SIZE)
+
 /*
  * Every time tlb miss occurs vm_fault gets called, because of a reason:
  * 1. Access to illegal range of memory or,
  * 2. Write to read only memory or,
- * 3. Accessing valid memory, that is already mapped but tlb is empty or,
- * 4. Accessing valid memory, that is NOT already mapped and needs to be allocated
+ * 3. Write to a copy-on-write page shared with a parent or child or,
+ * 4. Accessing valid memory, that is already mapped but tlb is empty or,
+ * 5. Accessing valid memory that has been swapped out or,
+ * 6. Accessing valid memory, that is NOT already mapped and needs to be allocated
+ *
+ * This wrapper does the profiling; vm_fault_path does the work.
 */
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
-    if (faulttype == VM_FAULT_READONLY) {
-        return EFAULT;
+    struct vm_prof *vp = &vm_prof[curcpu->c_number];
+    struct timespec before, after;
+    enum vm_fault_path path;
+
+    bool sample = (++vp->vp_faults % VM_PROF_SAMPLE) == 0;
+    if (sample) {
+        gettime(&before);
+    }
+
+    int result = vm_fault_path(faulttype, faultaddress, &path);
+    if (result) {
+        path = VMF_FAILED;
+    }
+    else if (vm_faultaround > 0 && path != VMF_STLB &&
+             path != VMF_LPFILL && path != VMF_LPLOAD) {
+        fault_around(faultaddress & PAGE_FRAME,
+                     path == VMF_ZEROFILL || path == VMF_ZEROPAGE ||
+                     path == VMF_FILEFILL || path == VMF_CACHEHIT);
     }
 
+    if (sample) {
+        gettime(&after);
+        timespec_sub(&after, &before, &after);
+        vp->vp_samples[path]++;
+        vp->vp_nsecs[path] += after.tv_sec * 1000000000ULL + after.tv_nsec;
+    }
+    vp->vp_count[path]++;
+
+    return result;
+}
+
+/*
+ * Resident pages are refilled from the page table entry alone: whether
+ * the page may be written is cached in the entry (PTE_WRITEABLE), so
+ * the regions are only consulted for pages with no entry yet.
+ */
+static int
+vm_fault_path(int faulttype, vaddr_t faultaddress, enum vm_fault_path *path)
+{
     struct addrspace *as = proc_getas();    // Get the current processes addrespace
 
     if (as == NULL) {
         return ESRCH;
     }
+    faultaddress &= PAGE_FRAME;
+
+    /* The translation may still be in this cpu's software tlb */
+    *path = VMF_STLB;
+    if (faulttype != VM_FAULT_READONLY &&
+        tlb_reload(faultaddress, faulttype == VM_FAULT_WRITE)) {
+        return 0;
+    }
+
+    /*
+     * Look at the entry with the page table locked, so the swapper
+     * can't take the frame away between reading it and loading the tlb
+     */
+    *path = VMF_REFILL;
+    spinlock_acquire(&as->pt_lock);
+    paddr_t *pte = lookup_pte(as, faultaddress);
+    paddr_t entry = (pte == NULL) ? NO_ENTRY : *pte;
+    int resident = entry != NO_ENTRY && !(entry & PTE_SWAPPED);
 
     /* Check page table and load tlb if translation valid */
-    paddr_t p_frame = get_pte(as, faultaddress);
-    if (p_frame != NO_ENTRY) {
-        tlb_refill(faultaddress & PAGE_FRAME, p_frame);     // EntryHi, EntryLo
+    if (resident && faulttype != VM_FAULT_READONLY &&
+        !(faulttype == VM_FAULT_WRITE && !(entry & TLBLO_DIRTY))) {
+        if (entry & PTE_LPAGE) {
+            *path = VMF_LPLOAD;
+            lpage_preload(as, faultaddress, entry);
+        }
+        else {
+            tlb_refill(faultaddress, entry);    // EntryHi, EntryLo
+        }
+        frame_reference(entry & PAGE_FRAME);
+        spinlock_release(&as->pt_lock);
         return 0;
     }
+    spinlock_release(&as->pt_lock);
+
+    if (entry != NO_ENTRY) {
+        /* Write to a page that may not be written at all */
+        if (faulttype != VM_FAULT_READ && !(entry & PTE_WRITEABLE)) {
+            return EFAULT;
+        }
+
+        /* Bring the page back in from swap */
+        if (entry & PTE_SWAPPED) {
+            *path = VMF_PAGEIN;
+            paddr_t frame = alloc_upage();
+            if (frame == 0) {
+                return ENOMEM;
+            }
+            int result = swap_pagein(as, faultaddress, frame);
+            if (result) {
+                free_upage(frame);
+            }
+            return result;
+        }
+
+        /* First write to a page of a mapped file */
+        if (entry & PTE_SHARED) {
+            *path = VMF_SHWRITE;
+            return shared_write(as, faultaddress, pte, entry);
+        }
 
-    /* Check if addr is valid in any region */ 
-    if (validate_region(as, faultaddress, faulttype)) {
+        /* Write to a page mapped read-only, copy it if it is copy-on-write */
+        *path = VMF_COW;
+        return copy_on_write(as, faultaddress, pte, entry);
+    }
+    if (faulttype == VM_FAULT_READONLY) {
+        return EFAULT;
+    }
+
+    /* Check if addr is valid in any region, or the stack growing into it */
+    struct region *f_region;
+    int result = region_lookup(as, faultaddress, faulttype, &f_region);
+    if (result == EFAULT && as_growstack(as, faultaddress) == 0) {
+        result = region_lookup(as, faultaddress, faulttype, &f_region);
+    }
+    if (result) {
         return EFAULT;
     }
     
-    /* Allocate a physical frame after all checks have been done */
-    vaddr_t new_va = alloc_kpages(1);
-    if (new_va == 0) {
-        return ENOMEM;
+    return fill_page(as, f_region, faultaddress, faulttype, path);
+}
+
+/*
+ * Map the vm_faultaround pages following a fault at FAULTADDRESS, on
+ * the bet that a program touching memory in order will want them
+ * next. Pages that are resident are loaded into the tlb. If FILL is
+ * set (the fault was a first touch, so this is likely fresh memory
+ * being swept) pages with no entry yet are filled too, as long as
+ * memory isn't short. They are filled as if read, even after a write
+ * fault, so that nothing is marked dirty (and, in a mapped file,
+ * written back) that hasn't been written; a real write later takes
+ * the usual write fault. Stops at the end of the region; pages out in
+ * swap are left to come in on their own.
+ *
+ * The faulting page's own entry is loaded again last, so that loading
+ * the others can't have pushed it out of the tlb.
+ */
+static void
+fault_around(vaddr_t faultaddress, bool fill)
+{
+    struct vm_prof *vp = &vm_prof[curcpu->c_number];
+    struct addrspace *as = proc_getas();
+    struct region *rg;
+    enum vm_fault_path path;
+    vaddr_t va = faultaddress;
+    unsigned loaded = 0;
+
+    for (unsigned k = 0; k < vm_faultaround; k++) {
+        va += PAGE_SIZE;
+        if (va >= MIPS_KSEG0) {
+            break;
+        }
+
+        spinlock_acquire(&as->pt_lock);
+        paddr_t *pte = lookup_pte(as, va);
+        paddr_t entry = (pte == NULL) ? NO_ENTRY : *pte;
+        if (entry != NO_ENTRY && !(entry & PTE_SWAPPED)) {
+            tlb_refill(va, entry);
+            frame_reference(entry & PAGE_FRAME);
+            spinlock_release(&as->pt_lock);
+            vp->vp_around_loads++;
+            loaded++;
+            continue;
+        }
+        spinlock_release(&as->pt_lock);
+
+        if (entry != NO_ENTRY || !fill) {
+            continue;
+        }
+        if (region_lookup(as, va, VM_FAULT_READ, &rg) ||
+            frame_nfree() <= reclaim_lowwater() ||
+            fill_page(as, rg, va, VM_FAULT_READ, &path)) {
+            break;
+        }
+        vp->vp_around_loads++;
+        vp->vp_around_fills++;
+        loaded++;
     }
 
-    bzero((void *) new_va, PAGE_SIZE);                      // Zero out entries in physical frame
-    paddr_t pfn = KVADDR_TO_PADDR(new_va) & PAGE_FRAME;     // Extract only the PFN
-    pfn = pfn | TLBLO_VALID;                                // Set valid bit
+    if (loaded > 0) {
+        spinlock_acquire(&as->pt_lock);
+        paddr_t *pte = lookup_pte(as, faultaddress);
+        if (pte != NULL && *pte != NO_ENTRY && !(*pte & PTE_SWAPPED)) {
+            tlb_update(faultaddress, *pte);
+        }
+        spinlock_release(&as->pt_lock);
+    }
+}
 
-    struct region *f_region = return_region(as, faultaddress); // Get the region to check permissions
-    if (f_region == NULL) {
-        return EFAULT;
+/*
+ * Set how many pages fault_around maps after each fault; 0 turns it
+ * off.
+ */
+int
+vm_setfaultaround(unsigned npages)
+{
+    if (npages > FAULTAROUND_MAX) {
+        return EINVAL;
     }
+    vm_faultaround = npages;
+    return 0;
+}
+
+unsigned
+vm_getfaultaround(void)
+{
+    return vm_faultaround;
+}
+
+/* Total faults taken so far, for comparing runs */
+uint32_t
+vm_nfaults(void)
+{
+    uint32_t total = 0;
+
+    for (int c = 0; c < MAXCPUS; c++) {
+        total += vm_prof[c].vp_faults;
+    }
+    return total;
+}
+
+/*
+ * First touch of the page at VADDR in region RG: give it a frame,
+ * filled from the file or zeroed, and map it.
+ */
+static int
+fill_page(struct addrspace *as, struct region *rg, vaddr_t vaddr,
+          int faulttype, enum vm_fault_path *path)
+{
+    /* Program text and mapped files are shared through the page cache */
+    if (rg->r_shared ||
+        (rg->r_vnode != NULL && rg->exec && !rg->ker_write)) {
+        int result = cached_fault(as, rg, vaddr, faulttype, path);
+        if (result != ENOENT) {
+            return result;
+        }
+    }
+
+    /* Reading memory nothing has written: map the zero page */
+    if (faulttype == VM_FAULT_READ &&
+        (rg->r_vnode == NULL || vaddr >= rg->r_fvaddr + rg->r_filesize ||
+         vaddr + PAGE_SIZE <= rg->r_fvaddr)) {
+        *path = VMF_ZEROPAGE;
+        paddr_t pfn = vm_zeroframe | TLBLO_VALID;
+        if (rg->write) {
+            pfn |= PTE_WRITEABLE;
+        }
+        frame_incref(vm_zeroframe);
+        if (insert_pte(as, vaddr, pfn)) {
+            frame_decref(vm_zeroframe);
+            return EFAULT;
+        }
+        tlb_refill(vaddr, pfn);
+        return 0;
+    }
+
+    /* Writing big anonymous memory: try for a whole large page */
+    if (faulttype == VM_FAULT_WRITE && rg->r_vnode == NULL &&
+        rg->write && fill_lpage(as, rg, vaddr) == 0) {
+        *path = VMF_LPFILL;
+        return 0;
+    }
+
+    /* Allocate a zeroed physical frame after all checks have been done */
+    *path = VMF_ZEROFILL;
+    paddr_t frame = alloc_zeroed_upage();
+    if (frame == 0) {
+        return ENOMEM;
+    }
+
+    /* Read in whatever part of the page the executable supplies */
+    if (rg->r_vnode != NULL) {
+        *path = VMF_FILEFILL;
+        int result = region_fill(rg, vaddr, frame);
+        if (result) {
+            free_upage(frame);
+            return result;
+        }
+    }
+
+    paddr_t pfn = frame | TLBLO_VALID;                      // Set valid bit
 
     /* Set write permissions */  
-    if (f_region->write) {
-        pfn = pfn | TLBLO_DIRTY;
+    if (rg->write) {
+        pfn = pfn | TLBLO_DIRTY | PTE_WRITEABLE;
     }
 
     /* Insert into page table */
-    if (insert_pte(as, faultaddress, pfn)) {
+    if (insert_pte(as, vaddr, pfn)) {
+        free_upage(frame);
+        return EFAULT;
+    }
+
+    /* Load the tlb, then let the swapper at the frame */
+    tlb_refill(vaddr, pfn);
+    frame_set_owner(frame, as, vaddr);
+    return 0;
+}
+
+/*
+ * Large pages. The R3000 tlb only maps 4K pages, so a large page here
+ * is an aligned run of LPAGE_PAGES physically contiguous frames, all
+ * filled on the first write to any of them, with every page's entry
+ * marked PTE_LPAGE. A miss on any page of the run then loads all of
+ * its resident pages at once, so sweeping a run costs one fault, not
+ * one per page. Each frame is otherwise an ordinary user frame: pages
+ * of a run are copied on write, swapped and freed one at a time, and
+ * simply drop out of the run (a page swapped back in loses PTE_LPAGE).
+ *
+ * Only done while free memory is well above the low watermark, and
+ * only for runs lying wholly inside the region with none of their
+ * pages touched yet. Returns ENOENT if a run can't be used, for the
+ * caller to fill a single page.
+ */
+static int
+fill_lpage(struct addrspace *as, struct region *rg, vaddr_t vaddr)
+{
+    vaddr_t base = vaddr & ~(vaddr_t)(LPAGE_SIZE - 1);
+    vaddr_t end = base + LPAGE_SIZE;
+    paddr_t run, pfn;
+    vaddr_t va;
+
+    if (base < rg->base_addr || end > rg->base_addr + rg->r_size ||
+        frame_nfree() <= reclaim_lowwater() + LPAGE_PAGES) {
+        return ENOENT;
+    }
+
+    spinlock_acquire(&as->pt_lock);
+    for (va = base; va < end; va += PAGE_SIZE) {
+        paddr_t *pte = lookup_pte(as, va);
+        if (pte != NULL && *pte != NO_ENTRY) {
+            break;
+        }
+    }
+    spinlock_release(&as->pt_lock);
+    if (va < end) {
+        return ENOENT;
+    }
+
+    run = frame_alloc_run(LPAGE_PAGES);
+    if (run == 0) {
+        return ENOENT;
+    }
+    bzero((void *) PADDR_TO_KVADDR(run), LPAGE_SIZE);
+
+    for (va = base; va < end; va += PAGE_SIZE) {
+        pfn = (run + (va - base)) | TLBLO_VALID | TLBLO_DIRTY |
+              PTE_WRITEABLE | PTE_LPAGE;
+        if (insert_pte(as, va, pfn)) {
+            /* Give back the frames that didn't get mapped */
+            for (; va < end; va += PAGE_SIZE) {
+                free_upage(run + (va - base));
+            }
+            return EFAULT;
+        }
+    }
+
+    spinlock_acquire(&as->pt_lock);
+    lpage_preload(as, vaddr, *lookup_pte(as, vaddr));
+    spinlock_release(&as->pt_lock);
+
+    for (va = base; va < end; va += PAGE_SIZE) {
+        frame_set_owner(run + (va - base), as, va);
+    }
+    return 0;
+}
+
+/*
+ * Load the resident pages of the large page run holding VADDR into the
+ * tlb, VADDR's own (ENTRY) last so that loading the others can't push
+ * it out again. Called with the page table locked.
+ */
+static void
+lpage_preload(struct addrspace *as, vaddr_t vaddr, paddr_t entry)
+{
+    struct vm_prof *vp = &vm_prof[curcpu->c_number];
+    vaddr_t base = vaddr & ~(vaddr_t)(LPAGE_SIZE - 1);
+
+    for (vaddr_t va = base; va < base + LPAGE_SIZE; va += PAGE_SIZE) {
+        paddr_t *pte = lookup_pte(as, va);
+        if (va == vaddr || pte == NULL || !(*pte & PTE_LPAGE)) {
+            continue;
+        }
+        tlb_refill(va, *pte);
+        frame_reference(*pte & PAGE_FRAME);
+        vp->vp_lpage_loads++;
+    }
+    tlb_refill(vaddr, entry);
+}
+
+/*
+ * Allocate a frame for a user page. If memory is short alloc_kpages
+ * reclaims, which includes evicting pages to swap. Returns 0 if there
+ * is no memory left.
+ */
+static paddr_t alloc_upage(void)
+{
+    vaddr_t va = alloc_kpages(1);
+
+    if (va == 0) {
+        return 0;
+    }
+    return KVADDR_TO_PADDR(va);
+}
+
+static void free_upage(paddr_t frame)
+{
+    free_kpages(PADDR_TO_KVADDR(frame));
+}
+
+/*
+ * Allocate a zero-filled frame for a user page, from the pool zeroed
+ * at idle time if it has one, otherwise zeroing it now.
+ */
+static paddr_t alloc_zeroed_upage(void)
+{
+    paddr_t frame = zeropool_get();
+
+    if (frame == 0) {
+        frame = alloc_upage();
+        if (frame != 0) {
+            bzero((void *) PADDR_TO_KVADDR(frame), PAGE_SIZE);
+        }
+    }
+    return frame;
+}
+
+/*
+ * Fill the (already zeroed) frame for the page at VADDR of a file
+ * backed region. Only the part of the page that overlaps the file
+ * data is read; the rest, such as the BSS, stays zero. The file data
+ * need not start or end on a page boundary, so the first and last
+ * pages may be partly filled.
+ *
+ * A page of a mapped file is different: it goes into the page cache
+ * for every mapping of that page, however long, so it is filled from
+ * the file as it is now, up to its real end.
+ */
+static int region_fill(struct region *rg, vaddr_t vaddr, paddr_t frame)
+{
+    vaddr_t start = vaddr;
+    vaddr_t end = vaddr + PAGE_SIZE;
+    struct iovec iov;
+    struct uio u;
+    int result;
+
+    if (rg->r_shared) {
+        uio_kinit(&iov, &u, (void *) PADDR_TO_KVADDR(frame), PAGE_SIZE,
+                  rg->r_foffset + (vaddr - rg->r_fvaddr), UIO_READ);
+        /* A short read is the end of the file; the rest stays zero */
+        return VOP_READ(rg->r_vnode, &u);
+    }
+
+    if (start < rg->r_fvaddr) {
+        start = rg->r_fvaddr;
+    }
+    if (end > rg->r_fvaddr + rg->r_filesize) {
+        end = rg->r_fvaddr + rg->r_filesize;
+    }
+    if (start >= end) {
+        return 0;
+    }
+
+    uio_kinit(&iov, &u, (void *) (PADDR_TO_KVADDR(frame) + (start - vaddr)),
+              end - start, rg->r_foffset + (start - rg->r_fvaddr), UIO_READ);
+    result = VOP_READ(rg->r_vnode, &u);
+    if (result) {
+        return result;
+    }
+    if (u.uio_resid != 0) {
+        /* The file has shrunk since it was loaded */
+        return EIO;
+    }
+    return 0;
+}
+
+/*
+ * First touch of a page that is shared through the page cache: either
+ * a page of a read-only executable region that is wholly file data, or
+ * any page of a file mapped with mmap. The page is looked up in (or,
+ * on a miss, read into) the page cache and mapped, shared with every
+ * other address space mapping the same page of the file.
+ *
+ * Mapped file pages are writeable in place, not copy-on-write; they
+ * are mapped read-only until first written so that the page cache
+ * knows which pages need writing back (see shared_write).
+ *
+ * The frame has no owner, so it is never evicted to swap; the page
+ * cache gives it back once nobody has it mapped. Returns ENOENT if
+ * the page can't be shared, for the caller to fill a private one.
+ */
+static int cached_fault(struct addrspace *as, struct region *rg,
+                        vaddr_t vaddr, int faulttype,
+                        enum vm_fault_path *path)
+{
+    off_t offset = rg->r_foffset + (vaddr - rg->r_fvaddr);
+    paddr_t frame, cached, pfn;
+    int result;
+
+    if (!rg->r_shared &&
+        (vaddr < rg->r_fvaddr ||
+         vaddr + PAGE_SIZE > rg->r_fvaddr + rg->r_filesize ||
+         (offset & ~(off_t)PAGE_FRAME) != 0)) {
+        return ENOENT;
+    }
+
+    *path = VMF_CACHEHIT;
+    frame = pcache_lookup(rg->r_vnode, offset);
+    if (frame == 0) {
+        *path = VMF_FILEFILL;
+        /* A mapping may run past the end of the file */
+        frame = rg->r_shared ? alloc_zeroed_upage() : alloc_upage();
+        if (frame == 0) {
+            return ENOMEM;
+        }
+        result = region_fill(rg, vaddr, frame);
+        if (result) {
+            free_upage(frame);
+            return result;
+        }
+        cached = pcache_insert(rg->r_vnode, offset, frame);
+        if (cached == 0 && rg->r_shared) {
+            /* Unshared, other processes wouldn't see our writes */
+            free_upage(frame);
+            return ENOMEM;
+        }
+        if (cached != 0) {
+            frame = cached;
+        }
+    }
+
+    pfn = frame | TLBLO_VALID;
+    if (rg->r_shared) {
+        pfn |= PTE_SHARED;
+        if (rg->write) {
+            pfn |= PTE_WRITEABLE;
+        }
+        if (faulttype == VM_FAULT_WRITE) {
+            pcache_setdirty(rg->r_vnode, offset);
+            pfn |= TLBLO_DIRTY;
+        }
+    }
+
+    if (insert_pte(as, vaddr, pfn)) {
+        frame_decref(frame);
         return EFAULT;
     }
+    tlb_refill(vaddr, pfn);
+    frame_reference(frame);
+    return 0;
+}
 
-    /* Load the tlb */
-    tlb_refill(faultaddress & PAGE_FRAME, pfn);
+/*
+ * First write to a page of a mapped file: mark the page dirty in the
+ * page cache, then let the write through.
+ */
+static int shared_write(struct addrspace *as, vaddr_t faultaddress,
+                        paddr_t *pte, paddr_t entry)
+{
+    struct region *rg;
+
+    if (region_lookup(as, faultaddress, VM_FAULT_WRITE, &rg)) {
+        return EFAULT;
+    }
+    pcache_setdirty(rg->r_vnode,
+                    rg->r_foffset + (faultaddress - rg->r_fvaddr));
+
+    spinlock_acquire(&as->pt_lock);
+    if (*pte == entry) {
+        *pte |= TLBLO_DIRTY;
+        tlb_update(faultaddress, *pte);
+    }
+    spinlock_release(&as->pt_lock);
     return 0;
 }
 
 /*
- * SMP-specific functions.  Unused in our UNSW configuration.
+ * Handle a write to a writeable page whose page table entry is
+ * read-only. The frame is shared copy-on-write after a fork: take a
+ * private copy, unless every other address space has already let go
+ * of it, in which case just make it writeable. A mapping of the zero
+ * page always gets a fresh zeroed frame.
+ *
+ * ENTRY is what *PTE held when the fault was looked at. If it has
+ * changed by the time we come to update it, the page was swapped out
+ * meanwhile and the fault is left to happen again.
  */
+static int
+copy_on_write(struct addrspace *as, vaddr_t faultaddress, paddr_t *pte,
+              paddr_t entry)
+{
+    paddr_t frame = entry & PAGE_FRAME;
+    paddr_t copy = 0;
+
+    if (frame == vm_zeroframe) {
+        copy = alloc_zeroed_upage();
+        if (copy == 0) {
+            return ENOMEM;
+        }
+    }
+    else if (frame_getref(frame) > 1) {
+        copy = alloc_upage();
+        if (copy == 0) {
+            return ENOMEM;
+        }
+        memcpy((void *) PADDR_TO_KVADDR(copy),
+               (void *) PADDR_TO_KVADDR(frame), PAGE_SIZE);
+    }
 
+    spinlock_acquire(&as->pt_lock);
+    if (*pte != entry) {
+        spinlock_release(&as->pt_lock);
+        if (copy != 0) {
+            free_upage(copy);
+        }
+        return 0;
+    }
+    *pte = (copy != 0 ? copy : frame | (entry & PTE_LPAGE)) |
+           TLBLO_VALID | TLBLO_DIRTY | PTE_WRITEABLE;
+    tlb_update(faultaddress, *pte);
+    spinlock_release(&as->pt_lock);
+
+    if (copy != 0) {
+        /* Other cpus may still map the old frame from when we ran there */
+        tlb_forget_remote(as);
+        frame_decref(frame);
+        frame = copy;
+    }
+    frame_set_owner(frame, as, faultaddress);
+    return 0;
+}
+
+/*
+ * SMP-specific functions.
+ */
+
+/* Another cpu has swapped out a page; drop it from our tlb */
 void
 vm_tlbshootdown(const struct tlbshootdown *ts)
 {
-	(void)ts;
-	panic("vm tried to do tlb shootdown?!\n");
+    tlb_invalidate(ts->ts_as, ts->ts_vaddr);
+    V(ts->ts_done);
+}
+
+/* Print VM statistics for the vmstat menu command */
+void
+vm_printstats(void)
+{
+    kprintf("vm: %u free frames, %u mappings of the zero page\n",
+            frame_nfree(), frame_getref(vm_zeroframe) - 1);
+
+    kprintf("Faults by path (one in %u timed):\n", VM_PROF_SAMPLE);
+    for (int p = 0; p < VMF_NPATHS; p++) {
+        uint32_t count = 0, samples = 0;
+        uint64_t nsecs = 0;
+        for (int c = 0; c < MAXCPUS; c++) {
+            count += vm_prof[c].vp_count[p];
+            samples += vm_prof[c].vp_samples[p];
+            nsecs += vm_prof[c].vp_nsecs[p];
+        }
+        kprintf("    %-8s %8u faults", vm_fault_pathnames[p], count);
+        if (samples > 0) {
+            kprintf(", %6llu ns average",
+                    (unsigned long long)(nsecs / samples));
+        }
+        kprintf("\n");
+    }
+
+    uint32_t loads = 0, fills = 0, lploads = 0;
+    for (int c = 0; c < MAXCPUS; c++) {
+        loads += vm_prof[c].vp_around_loads;
+        fills += vm_prof[c].vp_around_fills;
+        lploads += vm_prof[c].vp_lpage_loads;
+    }
+    kprintf("Fault-around: %u pages, %u neighbours mapped (%u first touched)\n",
+            vm_faultaround, loads, fills);
+    kprintf("Large pages: %u pages per run, %u neighbours preloaded\n",
+            LPAGE_PAGES, lploads);
+
+    tlb_printstats();
+    swap_printstats();
+    pcache_printstats();
+    zeropool_printstats();
+    ptpool_printstats();
 }
 
 /*
@@ -105,37 +832,120 @@ vm_tlbshootdown(const struct tlbshootdown *ts)
  * This ONLY handles putting stuff into and creating level two page
  * table entries and errors related to it. Allocating physical frames, zeroing
  * checking if the paddr is valid has to be done before or after. 
+ *
+ * A new level two table is taken from the pool before taking pt_lock,
+ * since that may sleep.
  * 
  * Return 0 indicates success
 */
 int insert_pte(struct addrspace *as, vaddr_t pt_index, paddr_t pt_entry) {
     uint32_t node1 = get_level_one(pt_index);
-    uint32_t node2 = get_level_two(pt_index);
-
-    if (as->page_table[node1] != NULL) {
+    paddr_t *pte;
+    int result = 0;
 
-        /* Page table entry already occupied */
-        if (as->page_table[node1][node2] != NO_ENTRY) {
-            return EFAULT;
+    /* Create a level two page table */
+    spinlock_acquire(&as->pt_lock);
+    pte = lookup_pte(as, pt_index);
+    spinlock_release(&as->pt_lock);
+    if (pte == NULL) {
+        paddr_t *table = ptpool_get();
+        if (table == NULL) {
+            return ENOMEM;
         }
+        result = pt_addtable(as, node1, table);
+        if (result) {
+            return result;
+        }
+    }
 
+    spinlock_acquire(&as->pt_lock);
+    pte = lookup_pte(as, pt_index);
+
+    /* Page table entry already occupied */
+    if (*pte != NO_ENTRY) {
+        result = EFAULT;
+    }
+    else {
         /* Insert entry no trouble */
-        as->page_table[node1][node2] = pt_entry;
-        return 0;
+        *pte = pt_entry;
     }
+    spinlock_release(&as->pt_lock);
+    return result;
+}
 
-    /* Create a level two page table */
-    as->page_table[node1] = kmalloc(PG_TABLE_TWO * sizeof(paddr_t));
-    if (as->page_table[node1] == NULL) {
-        return ENOMEM;
+/*
+ * Page table layout. Both levels are one page: the level one directory
+ * has 1024 slots of 4 MiB each, and a level two table has 1024 entries.
+ * Most programs only touch a few 4 MiB slots (text and data, the heap,
+ * the stack), so an address space starts with no directory at all and
+ * keeps up to PT_INLINE level two tables in the address space itself,
+ * found by a short search. A directory is only made when a program
+ * spreads wider than that. Either way pt_used marks the slots with a
+ * table, so a miss is one bit test and walks over the whole table
+ * skip the empty slots.
+ */
+paddr_t *pt_table(struct addrspace *as, uint32_t slot) {
+    if (!(as->pt_used[slot / 32] & (1U << (slot % 32)))) {
+        return NULL;
     }
+    if (as->page_table != NULL) {
+        return as->page_table[slot];
+    }
+    for (unsigned k = 0; k < as->pt_ninline; k++) {
+        if (as->pt_inline_slot[k] == slot) {
+            return as->pt_inline[k];
+        }
+    }
+    panic("pt_table: slot %u marked used but has no table\n", slot);
+}
+
+int pt_addtable(struct addrspace *as, uint32_t slot, paddr_t *table) {
+    paddr_t **dir = NULL;
 
-    /* Set all entries to empty for proper checking later */
-    for (int i = 0; i < PG_TABLE_TWO; i++) {
-        as->page_table[node1][node2] = NO_ENTRY;
+    spinlock_acquire(&as->pt_lock);
+    while (pt_table(as, slot) == NULL && as->page_table == NULL &&
+           as->pt_ninline == PT_INLINE && dir == NULL) {
+        /* Out of inline slots: get a directory, which may sleep */
+        spinlock_release(&as->pt_lock);
+        dir = ptpool_get();
+        if (dir == NULL) {
+            ptpool_put(table);
+            return ENOMEM;
+        }
+        spinlock_acquire(&as->pt_lock);
     }
 
-    as->page_table[node1][node2] = pt_entry;
+    if (pt_table(as, slot) == NULL) {
+        if (as->page_table == NULL && as->pt_ninline == PT_INLINE) {
+            /* Move the inline tables into the directory */
+            for (unsigned k = 0; k < PT_INLINE; k++) {
+                dir[as->pt_inline_slot[k]] = as->pt_inline[k];
+                as->pt_inline[k] = NULL;
+            }
+            as->pt_ninline = 0;
+            as->page_table = dir;
+            dir = NULL;
+        }
+        if (as->page_table != NULL) {
+            as->page_table[slot] = table;
+        }
+        else {
+            as->pt_inline[as->pt_ninline] = table;
+            as->pt_inline_slot[as->pt_ninline] = slot;
+            as->pt_ninline++;
+        }
+        as->pt_used[slot / 32] |= 1U << (slot % 32);
+        table = NULL;
+    }
+    spinlock_release(&as->pt_lock);
+
+    /* Whatever we didn't need after all */
+    if (table != NULL) {
+        ptpool_put(table);
+    }
+    if (dir != NULL) {
+        ptpool_put(dir);
+    }
     return 0;
 }
 
@@ -151,107 +961,111 @@ int insert_pte(struct addrspace *as, vaddr_t pt_index, paddr_t pt_entry) {
  * Physical address is used to load the tlb after
 */
 paddr_t get_pte(struct addrspace *as, vaddr_t pt_index) {
-    uint32_t node1 = get_level_one(pt_index);
-    uint32_t node2 = get_level_two(pt_index);
+    paddr_t *pte = lookup_pte(as, pt_index);
 
-    if (as->page_table[node1] == NULL) {
+    if (pte == NULL) {
         return NO_ENTRY;
     }
+    return *pte;
+}
 
-    if (as->page_table[node1][node2] == NO_ENTRY) {
-        return NO_ENTRY;
+/*
+ * Returns a pointer to the page table slot for a vaddr, so the entry
+ * can be changed in place, or NULL if there is no level two table
+ * covering it yet.
+*/
+paddr_t *lookup_pte(struct addrspace *as, vaddr_t pt_index) {
+    paddr_t *table = pt_table(as, get_level_one(pt_index));
+
+    if (table == NULL) {
+        return NULL;
     }
+    return &table[get_level_two(pt_index)];
+}
 
-    /* This is used for as_complete_load */
-    struct region *f_region = return_region(as, pt_index); // Get the region to check permissions
-    if (f_region == NULL) {
-        return EFAULT;
+/*
+ * Find the region containing a vaddr. The regions are sorted by base
+ * address, so this is a binary search for the last region starting at
+ * or below the vaddr. Faults tend to come in runs within one region, so
+ * the region found last time is checked first.
+ *
+ * Returns NULL if no region contains the vaddr.
+*/
+static struct region *find_region(struct addrspace *as, vaddr_t vaddr) {
+    struct region *rg = as->last_region;
+
+    if (rg != NULL && vaddr >= rg->base_addr &&
+        vaddr < rg->base_addr + rg->r_size) {
+        return rg;
+    }
+
+    /* Invariant: regions [0, lo) start at or below vaddr, [hi, n) above */
+    unsigned lo = 0;
+    unsigned hi = regionarray_num(&as->regions);
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if (regionarray_get(&as->regions, mid)->base_addr <= vaddr) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return NULL;
     }
 
-    if (f_region->ker_write) {
-        as->page_table[node1][node2] =  as->page_table[node1][node2] | TLBLO_DIRTY;
+    rg = regionarray_get(&as->regions, lo - 1);
+    if (vaddr >= rg->base_addr + rg->r_size) {
+        return NULL;
     }
 
-    return as->page_table[node1][node2];
+    as->last_region = rg;
+    return rg;
 }
 
 /*
- * Goes through the region data struture and checks if the 
- * vaddr_t exists in any region.
+ * Looks up the region a vaddr exists in and checks the region allows
+ * the kind of access that faulted, all in one go.
  *
- * Return 0 indicates success
+ * Return 0 indicates success, and the region is handed back in ret
  * 
 */
-int validate_region(struct addrspace *as, vaddr_t faultaddress, int faulttype) {
-    struct region *curr = as->head;
-    int found = 0;
-
-    /* Iterate through the regions and check if vaddr is inbetween any */
-    while (curr != NULL) {
-        if ((faultaddress >= curr->base_addr) && 
-            (faultaddress < curr->base_addr + curr->r_size)) {
-                found = 1;
-                break;
-        }
-        curr = curr->next;
-    }
-    if (!found) {
+int region_lookup(struct addrspace *as, vaddr_t vaddr, int faulttype,
+                  struct region **ret) {
+    struct region *rg = find_region(as, vaddr);
+    if (rg == NULL) {
         return EFAULT;
     }
 
-    if (faulttype == VM_FAULT_READ && !curr->read) {
+    if (faulttype == VM_FAULT_READ && !rg->read) {
         return EPERM;       // Cant read from region
     }
 
-    if (faulttype == VM_FAULT_WRITE && !curr->write) {
+    if ((faulttype == VM_FAULT_WRITE || faulttype == VM_FAULT_READONLY) &&
+        !rg->write) {
         return EPERM;       // Cant write to region
     }
 
+    *ret = rg;
     return 0;
 }
 
-/*
- * This returns the region a vaddr exists in. 
- * Should not error as it assumes the region exists 
-*/
-struct region *return_region(struct addrspace *as, vaddr_t faultaddress) {
-    struct region *curr = as->head;
-    int found = 0;
-    while (curr != NULL) {
-        if ((faultaddress >= curr->base_addr) && 
-            (faultaddress < curr->base_addr + curr->r_size)) {
-                found = 1;
-                break;
-        }
-        curr = curr->next;
-    }
-    if (!found) {
-        return NULL;
-    }
-    return curr;
-}
-
 
-/* Functions to extract first 11 and 
- * 9 bits from VA respectively for pg table
+/*
+ * Split a virtual address for the page table: the top 10 bits index
+ * the level one directory, and the next 10 the level two table.
  */
 
 uint32_t get_level_one(vaddr_t vaddrs) {
     uint32_t pt_one = vaddrs & PAGE_FRAME;
-    pt_one = pt_one >> 21;
+    pt_one = pt_one >> 22;
     return pt_one;
 }
 
 uint32_t get_level_two(vaddr_t vaddrs) {
     uint32_t pt_two = vaddrs & PAGE_FRAME;
-    pt_two = pt_two << 11;
-    pt_two = pt_two >> 23;
+    pt_two = pt_two << 10;
+    pt_two = pt_two >> 22;
     return pt_two;
 }
-
-/* Load tlb after refill */
-void tlb_refill(uint32_t entryhi, uint32_t entrylo) {
-    int spl = splhigh();
-    tlb_random(entryhi, entrylo);
-    splx(spl);
-}
\ No newline at end of file
@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Pool of pre-zeroed frames, filled at idle time. See zeropool.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <threadlist.h>
+#include <cpu.h>
+#include <current.h>
+#include <vm.h>
+#include <reclaim.h>
+#include <zeropool.h>
+#include <platform/maxcpus.h>
+
+#define ZEROPOOL_SIZE   32	/* frames the pool holds when full */
+#define ZEROPOOL_BATCH  4	/* frames zeroed each time the thread runs */
+
+/* The pool and statistics, protected by zeropool_spinlock */
+static struct spinlock zeropool_spinlock = SPINLOCK_INITIALIZER;
+static paddr_t zeropool_frames[ZEROPOOL_SIZE];
+static unsigned zeropool_count;
+static uint32_t zeropool_hits;
+static uint32_t zeropool_misses;
+static uint32_t zeropool_zeroed;
+
+/*
+ * One zeroing thread per cpu, bound to it, so that an idle cpu wakes
+ * a thread that will run on that cpu and not on some busy one. Each
+ * sleeps on its own wchan; zc_wchan is NULL until the thread exists.
+ * zc_sleeping is protected by zeropool_spinlock.
+ */
+struct zeropool_cpu {
+	struct wchan *zc_wchan;
+	volatile bool zc_sleeping;
+};
+static struct zeropool_cpu zeropool_cpus[MAXCPUS];
+
+/*
+ * The pool is worth filling if it isn't full and memory isn't short;
+ * frames needed for real work shouldn't sit in it.
+ */
+static
+bool
+zeropool_wanted(void)
+{
+	return zeropool_count < ZEROPOOL_SIZE &&
+		frame_nfree() > reclaim_lowwater();
+}
+
+paddr_t
+zeropool_get(void)
+{
+	paddr_t frame = 0;
+
+	spinlock_acquire(&zeropool_spinlock);
+	if (zeropool_count > 0) {
+		frame = zeropool_frames[--zeropool_count];
+		zeropool_hits++;
+	}
+	else {
+		zeropool_misses++;
+	}
+	spinlock_release(&zeropool_spinlock);
+
+	return frame;
+}
+
+bool
+zeropool_idle(void)
+{
+	struct zeropool_cpu *zc = &zeropool_cpus[curcpu->c_number];
+	bool woke = false;
+
+	/* Unlocked peek; it doesn't matter if it's a bit stale */
+	if (zc->zc_wchan == NULL || !zc->zc_sleeping || !zeropool_wanted()) {
+		return false;
+	}
+
+	spinlock_acquire(&zeropool_spinlock);
+	if (zc->zc_sleeping) {
+		zc->zc_sleeping = false;
+		wchan_wakeone(zc->zc_wchan, &zeropool_spinlock);
+		woke = true;
+	}
+	spinlock_release(&zeropool_spinlock);
+
+	return woke;
+}
+
+unsigned
+zeropool_npooled(void)
+{
+	/* One word; a stale value is as good as any */
+	return zeropool_count;
+}
+
+/*
+ * A zeroing thread. Zeroes a batch of frames each time its cpu goes
+ * idle and wakes it, stopping early if something else becomes ready
+ * to run there. Frames are allocated with alloc_kpages, but only
+ * while memory isn't short, so this never causes reclaim.
+ */
+static
+void
+zeropool_thread(void *data1, unsigned long unused)
+{
+	struct zeropool_cpu *zc = data1;
+	vaddr_t va;
+	unsigned n;
+
+	(void)unused;
+
+	spinlock_acquire(&zeropool_spinlock);
+	while (1) {
+		zc->zc_sleeping = true;
+		wchan_sleep(zc->zc_wchan, &zeropool_spinlock);
+
+		for (n = 0; n < ZEROPOOL_BATCH && zeropool_wanted(); n++) {
+			/* Unlocked peek at our own cpu's run queue */
+			if (!threadlist_isempty(&curcpu->c_runqueue)) {
+				break;
+			}
+			spinlock_release(&zeropool_spinlock);
+			va = alloc_kpages(1);
+			if (va == 0) {
+				spinlock_acquire(&zeropool_spinlock);
+				break;
+			}
+			bzero((void *)va, PAGE_SIZE);
+
+			spinlock_acquire(&zeropool_spinlock);
+			if (zeropool_count == ZEROPOOL_SIZE) {
+				/* Another cpu's thread filled it */
+				spinlock_release(&zeropool_spinlock);
+				free_kpages(va);
+				spinlock_acquire(&zeropool_spinlock);
+				break;
+			}
+			zeropool_frames[zeropool_count++] = KVADDR_TO_PADDR(va);
+			zeropool_zeroed++;
+		}
+	}
+}
+
+/*
+ * Shrinker: give pooled frames back. They are cheap to make again.
+ */
+static
+unsigned
+zeropool_shrink(unsigned nframes)
+{
+	paddr_t frame;
+	unsigned n;
+
+	for (n = 0; n < nframes; n++) {
+		spinlock_acquire(&zeropool_spinlock);
+		if (zeropool_count == 0) {
+			spinlock_release(&zeropool_spinlock);
+			break;
+		}
+		frame = zeropool_frames[--zeropool_count];
+		spinlock_release(&zeropool_spinlock);
+
+		free_kpages(PADDR_TO_KVADDR(frame));
+	}
+	return n;
+}
+
+static struct shrinker zeropool_shrinker = {
+	.sh_name = "zeropool",
+	.sh_shrink = zeropool_shrink,
+};
+
+void
+zeropool_bootstrap(void)
+{
+	struct zeropool_cpu *zc;
+	unsigned i;
+	int result;
+
+	reclaim_register(&zeropool_shrinker);
+
+	for (i = 0; i < thread_ncpus(); i++) {
+		KASSERT(i < MAXCPUS);
+		zc = &zeropool_cpus[i];
+
+		zc->zc_wchan = wchan_create("zeropool");
+		if (zc->zc_wchan == NULL) {
+			panic("zeropool_bootstrap: Out of memory\n");
+		}
+
+		result = thread_fork_bound("zeropool", NULL, i,
+					   zeropool_thread, zc, 0);
+		if (result) {
+			panic("zeropool_bootstrap: thread_fork: %s\n",
+			      strerror(result));
+		}
+	}
+}
+
+void
+zeropool_printstats(void)
+{
+	uint32_t gets = zeropool_hits + zeropool_misses;
+
+	kprintf("zeropool: %u of %u frames ready, %u zeroed at idle, "
+		"%u of %u first touches from the pool (%u%%), "
+		"%u zeroed on the spot\n",
+		zeropool_count, ZEROPOOL_SIZE, zeropool_zeroed,
+		zeropool_hits, gets, gets ? zeropool_hits * 100 / gets : 0,
+		zeropool_misses);
+}
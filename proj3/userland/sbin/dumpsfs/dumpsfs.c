@@ -358,6 +358,11 @@ recursedirblock(uint32_t fileblock, uint32_t diskblock)
 			continue;
 		}
 		sds[i].sfd_name[SFS_NAMELEN-1] = 0; /* just in case */
+		if (!strcmp(sds[i].sfd_name, ".") ||
+		    !strcmp(sds[i].sfd_name, "..")) {
+			/* don't go around in circles */
+			continue;
+		}
 		dumpinode(ino, sds[i].sfd_name);
 	}
 }
@@ -449,6 +454,9 @@ dumpinode(uint32_t ino, const char *name)
 	dumpvalf("Type", "%u (%s)", SWAP16(sfi.sfi_type), typename);
 	dumpvalf("Size", "%u", SWAP32(sfi.sfi_size));
 	dumpvalf("Link count", "%u", SWAP16(sfi.sfi_linkcount));
+	if (sfi.sfi_dirhash != 0) {
+		dumpvalf("Hash buckets", "%u", SWAP32(sfi.sfi_dirhash));
+	}
 	printf("\n");
 
         printf("    Direct blocks:\n");
@@ -73,6 +73,7 @@ check(void)
 	assert(sizeof(struct sfs_superblock)==SFS_BLOCKSIZE);
 	assert(sizeof(struct sfs_dinode)==SFS_BLOCKSIZE);
 	assert(SFS_BLOCKSIZE % sizeof(struct sfs_direntry) == 0);
+	assert(SFS_DIRHASH_NBUCKETS <= SFS_DIRHASH_MAXBUCKETS);
 }
 
 /*
@@ -165,19 +166,85 @@ writefreemap(uint32_t fsblocks)
 }
 
 /*
- * Write out the root directory inode.
+ * Hash a name for a hashed directory (see kern/sfs.h).
+ */
+static
+uint32_t
+dirhash(const char *name)
+{
+	uint32_t h = SFS_DIRHASH_BASIS;
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= SFS_DIRHASH_PRIME;
+	}
+	return h;
+}
+
+/*
+ * Write out the root directory. It's a hashed directory, so it's
+ * SFS_DIRHASH_NBUCKETS blocks long, but only the buckets . and .. land
+ * in are actually allocated, starting at FIRSTBLOCK.
  */
 static
 void
-writerootdir(void)
+writerootdir(uint32_t firstblock, uint32_t fsblocks)
 {
+	static const char *const names[] = { ".", ".." };
 	struct sfs_dinode sfi;
+	struct sfs_direntry sds[SFS_BLOCKSIZE/sizeof(struct sfs_direntry)];
+	uint32_t indirect[SFS_DBPERIDB];
+	uint32_t nextblock, bucket, block, i;
 
 	/* Initialize the dinode */
 	bzero((void *)&sfi, sizeof(sfi));
-	sfi.sfi_size = SWAP32(0);
+	bzero((void *)indirect, sizeof(indirect));
+	sfi.sfi_size = SWAP32(SFS_DIRHASH_NBUCKETS * SFS_BLOCKSIZE);
 	sfi.sfi_type = SWAP16(SFS_TYPE_DIR);
-	sfi.sfi_linkcount = SWAP16(1);
+	sfi.sfi_linkcount = SWAP16(2);
+	sfi.sfi_dirhash = SWAP32(SFS_DIRHASH_NBUCKETS);
+
+	/*
+	 * Write . and .. (both the root itself). They're the only
+	 * entries and they hash to different buckets, so each goes in
+	 * slot 0 of a block of its own.
+	 */
+	nextblock = firstblock;
+	for (i=0; i<sizeof(names)/sizeof(names[0]); i++) {
+		bucket = dirhash(names[i]) % SFS_DIRHASH_NBUCKETS;
+		assert(i == 0 || bucket !=
+		       dirhash(names[0]) % SFS_DIRHASH_NBUCKETS);
+
+		bzero((void *)sds, sizeof(sds));
+		sds[0].sfd_ino = SWAP32(SFS_ROOTDIR_INO);
+		strcpy(sds[0].sfd_name, names[i]);
+
+		block = nextblock++;
+		if (block >= fsblocks) {
+			errx(1, "Filesystem too small for the root directory");
+		}
+		allocblock(block);
+		diskwrite(sds, block);
+
+		if (bucket < SFS_NDIRECT) {
+			sfi.sfi_direct[bucket] = SWAP32(block);
+		}
+		else {
+			indirect[bucket - SFS_NDIRECT] = SWAP32(block);
+			if (sfi.sfi_indirect == 0) {
+				block = nextblock++;
+				if (block >= fsblocks) {
+					errx(1, "Filesystem too small for "
+					     "the root directory");
+				}
+				allocblock(block);
+				sfi.sfi_indirect = SWAP32(block);
+			}
+		}
+	}
+	if (sfi.sfi_indirect != 0) {
+		diskwrite(indirect, SWAP32(sfi.sfi_indirect));
+	}
 
 	/* Write it out */
 	diskwrite(&sfi, SFS_ROOTDIR_INO);
@@ -231,8 +298,8 @@ main(int argc, char **argv)
 	/* Write out the on-disk structures */
 	initfreemap(size);
 	writesuper(volname, size);
+	writerootdir(SFS_FREEMAP_START + SFS_FREEMAPBLOCKS(size), size);
 	writefreemap(size);
-	writerootdir();
 
 	closedisk();
 
@@ -277,6 +277,16 @@ pass1_inode(uint32_t ino, struct sfs_dinode *sfi, int alreadychanged)
 		changed = 1;
 	}
 
+	if (sfi->sfi_dirhash != 0 &&
+	    (!isdir || sfi->sfi_dirhash > SFS_DIRHASH_MAXBUCKETS ||
+	     sfi->sfi_size != sfi->sfi_dirhash * SFS_BLOCKSIZE)) {
+		warnx("Inode %lu: Invalid hash bucket count %lu (cleared)",
+		      (unsigned long) ino, (unsigned long) sfi->sfi_dirhash);
+		setbadness(EXIT_RECOV);
+		sfi->sfi_dirhash = 0;
+		changed = 1;
+	}
+
 	if (check_inode_blocks(ino, sfi, isdir)) {
 		changed = 1;
 	}
@@ -173,7 +173,14 @@ pass2_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 	 */
 
 	if (!dotseen) {
-		if (sfsdir_tryadd(direntries, ndirentries, ".", ino)==0) {
+		if (sfi.sfi_dirhash != 0 &&
+		    sfsdir_hashadd(&sfi, direntries, ".", ino)==0) {
+			setbadness(EXIT_RECOV);
+			warnx("Directory %s: No `.' entry (added)",
+			      pathsofar);
+			dchanged = 1;
+		}
+		else if (sfsdir_tryadd(direntries, ndirentries, ".", ino)==0) {
 			setbadness(EXIT_RECOV);
 			warnx("Directory %s: No `.' entry (added)",
 			      pathsofar);
@@ -201,8 +208,15 @@ pass2_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 	 */
 
 	if (!dotdotseen) {
-		if (sfsdir_tryadd(direntries, ndirentries, "..",
-				  parentino)==0) {
+		if (sfi.sfi_dirhash != 0 &&
+		    sfsdir_hashadd(&sfi, direntries, "..", parentino)==0) {
+			setbadness(EXIT_RECOV);
+			warnx("Directory %s: No `..' entry (added)",
+			      pathsofar);
+			dchanged = 1;
+		}
+		else if (sfsdir_tryadd(direntries, ndirentries, "..",
+				       parentino)==0) {
 			setbadness(EXIT_RECOV);
 			warnx("Directory %s: No `..' entry (added)",
 			      pathsofar);
@@ -297,6 +311,22 @@ pass2_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 		ichanged = 1;
 	}
 
+	/*
+	 * If the directory is hashed, make sure the kernel will still be
+	 * able to find everything; if not, fall back to searching it
+	 * linearly. (Entries we've removed or renamed above, or added
+	 * in the wrong place, can cause this.)
+	 */
+
+	if (sfi.sfi_dirhash != 0 &&
+	    sfsdir_hashcheck(direntries, sfi.sfi_dirhash)) {
+		setbadness(EXIT_RECOV);
+		warnx("Directory %s: Entries not in hash order "
+		      "(made unhashed)", pathsofar);
+		sfi.sfi_dirhash = 0;
+		ichanged = 1;
+	}
+
 	/*
 	 * Write back anything that changed, clean up, and return.
 	 */
@@ -97,6 +97,7 @@ swapinode(struct sfs_dinode *sfi)
 	for (i=0; i<NUM_III; i++) {
 		SET_III(sfi, i) = SWAP32(GET_III(sfi, i));
 	}
+	sfi->sfi_dirhash = SWAP32(sfi->sfi_dirhash);
 }
 
 static
@@ -268,11 +269,12 @@ sfs_writeindirect(uint32_t blocknum, uint32_t *entries)
 // directory I/O
 
 /*
- * Read the directory block at DISKBLOCK into D.
+ * Read the directory block at DISKBLOCK into D. Holes are expected
+ * in hashed directories (SPARSEOK); otherwise they get a warning.
  */
 static
 void
-sfs_readdirblock(struct sfs_direntry *d, uint32_t diskblock)
+sfs_readdirblock(struct sfs_direntry *d, uint32_t diskblock, int sparseok)
 {
 	const unsigned atonce = SFS_BLOCKSIZE/sizeof(struct sfs_direntry);
 	unsigned j;
@@ -284,7 +286,9 @@ sfs_readdirblock(struct sfs_direntry *d, uint32_t diskblock)
 		}
 	}
 	else {
-		warnx("Warning: sparse directory found");
+		if (!sparseok) {
+			warnx("Warning: sparse directory found");
+		}
 		bzero(d, SFS_BLOCKSIZE);
 	}
 }
@@ -309,14 +313,16 @@ sfs_readdir(struct sfs_dinode *sfi, struct sfs_direntry *d, unsigned nd)
 		diskblock = bmap(sfi, i);
 		if (left < atonce) {
 			thismany = left;
-			sfs_readdirblock(buffer, diskblock);
+			sfs_readdirblock(buffer, diskblock,
+					 sfi->sfi_dirhash != 0);
 			for (j=0; j<thismany; j++) {
 				d[i*atonce + j] = buffer[j];
 			}
 		}
 		else {
 			thismany = atonce;
-			sfs_readdirblock(d + i*atonce, diskblock);
+			sfs_readdirblock(d + i*atonce, diskblock,
+					 sfi->sfi_dirhash != 0);
 		}
 		left -= thismany;
 	}
@@ -462,3 +468,86 @@ sfsdir_tryadd(struct sfs_direntry *d, int nd, const char *name, uint32_t ino)
 	}
 	return -1;
 }
+
+/*
+ * Hash a name for a hashed directory (see kern/sfs.h).
+ */
+static
+uint32_t
+sfsdir_hash(const char *name)
+{
+	uint32_t h = SFS_DIRHASH_BASIS;
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= SFS_DIRHASH_PRIME;
+	}
+	return h;
+}
+
+/*
+ * Try to add an entry NAME/INO to the hashed directory D, whose inode
+ * is SFI, where the kernel will look for it. Fails if that's in a
+ * block that isn't allocated, since we can't allocate one.
+ *
+ * Returns 0 on success and nonzero on failure.
+ */
+int
+sfsdir_hashadd(const struct sfs_dinode *sfi, struct sfs_direntry *d,
+	       const char *name, uint32_t ino)
+{
+	const unsigned atonce = SFS_BLOCKSIZE/sizeof(struct sfs_direntry);
+	uint32_t nbuckets = sfi->sfi_dirhash;
+	uint32_t bucket, n;
+	unsigned i;
+
+	assert(nbuckets > 0);
+	bucket = sfsdir_hash(name) % nbuckets;
+	for (n=0; n<nbuckets; n++) {
+		for (i=0; i<atonce; i++) {
+			if (d[bucket*atonce + i].sfd_ino == SFS_NOINO) {
+				if (bmap(sfi, bucket) == 0) {
+					return -1;
+				}
+				return sfsdir_tryadd(&d[bucket*atonce], atonce,
+						     name, ino);
+			}
+		}
+		bucket = (bucket + 1) % nbuckets;
+	}
+	return -1;
+}
+
+/*
+ * Check that every entry in the hashed directory D (with NBUCKETS
+ * buckets) can be found by probing from its home bucket; that is,
+ * every bucket it was passed over in is full.
+ *
+ * Returns 0 if so and nonzero if not.
+ */
+int
+sfsdir_hashcheck(struct sfs_direntry *d, uint32_t nbuckets)
+{
+	const unsigned atonce = SFS_BLOCKSIZE/sizeof(struct sfs_direntry);
+	uint32_t bucket, b;
+	unsigned i, j;
+
+	for (bucket=0; bucket<nbuckets; bucket++) {
+		for (i=0; i<atonce; i++) {
+			if (d[bucket*atonce + i].sfd_ino == SFS_NOINO) {
+				continue;
+			}
+			b = sfsdir_hash(d[bucket*atonce + i].sfd_name)
+				% nbuckets;
+			for (; b != bucket; b = (b + 1) % nbuckets) {
+				for (j=0; j<atonce; j++) {
+					if (d[b*atonce + j].sfd_ino ==
+					    SFS_NOINO) {
+						return -1;
+					}
+				}
+			}
+		}
+	}
+	return 0;
+}
@@ -74,6 +74,11 @@ void sfs_writedir(const struct sfs_dinode *sfi,
 int sfsdir_tryadd(struct sfs_direntry *d, int nd,
 		  const char *name, uint32_t ino);
 
+/* Add an entry to, or check the layout of, a hashed directory. */
+int sfsdir_hashadd(const struct sfs_dinode *sfi, struct sfs_direntry *d,
+		   const char *name, uint32_t ino);
+int sfsdir_hashcheck(struct sfs_direntry *d, uint32_t nbuckets);
+
 /* Sort a directory by creating a permutation vector. */
 void sfsdir_sort(struct sfs_direntry *d, unsigned nd, int *vector);
 
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * manyfiles - time create, lookup, and remove in a big directory.
+ *
+ * Usage: manyfiles [count]
+ *
+ * Creates COUNT empty files (default 1000) in the current directory,
+ * opens each of them again in a different order, looks up as many
+ * names that don't exist, and then removes them all, printing how
+ * long each phase took and the average per file.
+ *
+ * SFS only has the root directory, which holds at most 1142 files, so
+ * the default is close to as many as there is room for.
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+#include <test/timing.h>
+
+#define DEFAULT_COUNT 1000
+
+static
+void
+mkname(char *buf, size_t len, const char *prefix, unsigned n)
+{
+	snprintf(buf, len, "%s%u", prefix, n);
+}
+
+static
+void
+report(const char *what, unsigned count, unsigned long ms)
+{
+	printf("%-8s %5u files: %6lu ms (%lu us each)\n", what, count, ms,
+	       ms * 1000 / count);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char name[32];
+	unsigned count, i, n;
+	time_t secs;
+	unsigned long nsecs;
+	int fd;
+
+	count = DEFAULT_COUNT;
+	if (argc > 1) {
+		count = atoi(argv[1]);
+	}
+	if (argc > 2 || count == 0) {
+		errx(1, "Usage: manyfiles [count]");
+	}
+
+	now(&secs, &nsecs);
+	for (i=0; i<count; i++) {
+		mkname(name, sizeof(name), "mf", i);
+		fd = open(name, O_WRONLY|O_CREAT|O_EXCL, 0664);
+		if (fd < 0) {
+			err(1, "%s: create", name);
+		}
+		close(fd);
+	}
+	report("create", count, msecs_since(secs, nsecs));
+
+	/* Go through in a scattered order so it's not all cached. */
+	now(&secs, &nsecs);
+	for (i=0; i<count; i++) {
+		n = (i * 7919) % count;
+		mkname(name, sizeof(name), "mf", n);
+		fd = open(name, O_RDONLY);
+		if (fd < 0) {
+			err(1, "%s: open", name);
+		}
+		close(fd);
+	}
+	report("lookup", count, msecs_since(secs, nsecs));
+
+	now(&secs, &nsecs);
+	for (i=0; i<count; i++) {
+		mkname(name, sizeof(name), "nf", i);
+		fd = open(name, O_RDONLY);
+		if (fd >= 0) {
+			errx(1, "%s: open succeeded on a missing file", name);
+		}
+		if (errno != ENOENT) {
+			err(1, "%s: open", name);
+		}
+	}
+	report("missing", count, msecs_since(secs, nsecs));
+
+	now(&secs, &nsecs);
+	for (i=0; i<count; i++) {
+		mkname(name, sizeof(name), "mf", i);
+		if (remove(name)) {
+			err(1, "%s: remove", name);
+		}
+	}
+	report("remove", count, msecs_since(secs, nsecs));
+
+	printf("Passed manyfiles.\n");
+	return 0;
+}
@@ -0,0 +1,382 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * mmapscan - compare scanning a file through mmap with read().
+ *
+ * Usage: mmapscan [filename [kilobytes]]
+ *
+ * Writes a file of the given size (default 2048 KiB), then checksums
+ * it twice, once with read() into a buffer and once through an mmap of
+ * the whole file, and prints how long each took. The first pass of
+ * each warms the cache for the other, so the file is scanned twice
+ * each way and the second pass is the one reported.
+ *
+ * It then checks MAP_SHARED behaviour: a forked child writes through
+ * the inherited mapping and the parent must see it, and after munmap
+ * the same data must come back from read(). Then it checks that
+ * mappings and read()/write()/ftruncate() agree without any munmap or
+ * fsync in between, and that a mapping shorter than a page doesn't
+ * hide or clobber the rest of that page from other mappings.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <test/timing.h>
+
+#define BUFSIZE 4096
+
+static unsigned char buf[BUFSIZE];
+
+static
+unsigned char
+pattern(size_t pos)
+{
+	return (unsigned char)(pos * 7 + pos / 4096);
+}
+
+static
+void
+makefile(const char *name, size_t size)
+{
+	size_t pos, i;
+	ssize_t r;
+	int fd;
+
+	fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s: open", name);
+	}
+	for (pos = 0; pos < size; pos += BUFSIZE) {
+		for (i = 0; i < BUFSIZE; i++) {
+			buf[i] = pattern(pos + i);
+		}
+		r = write(fd, buf, BUFSIZE);
+		if (r < 0) {
+			err(1, "%s: write", name);
+		}
+		if (r != BUFSIZE) {
+			errx(1, "%s: short write", name);
+		}
+	}
+	close(fd);
+}
+
+static
+unsigned
+readscan(int fd, size_t size)
+{
+	unsigned sum = 0;
+	size_t pos, i;
+	ssize_t r;
+
+	lseek(fd, 0, SEEK_SET);
+	for (pos = 0; pos < size; pos += r) {
+		r = read(fd, buf, BUFSIZE);
+		if (r < 0) {
+			err(1, "read");
+		}
+		if (r == 0) {
+			errx(1, "Unexpected EOF");
+		}
+		for (i = 0; i < (size_t)r; i++) {
+			sum += buf[i];
+		}
+	}
+	return sum;
+}
+
+static
+unsigned
+mmapscan(int fd, size_t size)
+{
+	unsigned char *p;
+	unsigned sum = 0;
+	size_t i;
+
+	p = mmap(size, PROT_READ, fd, 0);
+	if (p == (void *)-1) {
+		err(1, "mmap");
+	}
+	for (i = 0; i < size; i++) {
+		sum += p[i];
+	}
+	if (munmap(p)) {
+		err(1, "munmap");
+	}
+	return sum;
+}
+
+static
+void
+sharetest(int fd, size_t size)
+{
+	unsigned char *p;
+	size_t i;
+	pid_t pid;
+	int status;
+
+	p = mmap(size, PROT_READ|PROT_WRITE, fd, 0);
+	if (p == (void *)-1) {
+		err(1, "mmap");
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		/* Every page, but not every byte */
+		for (i = 0; i < size; i += 1000) {
+			p[i] = ~pattern(i);
+		}
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "child failed");
+	}
+
+	for (i = 0; i < size; i += 1000) {
+		if (p[i] != (unsigned char)~pattern(i)) {
+			errx(1, "Mapping: wrong data at offset %lu",
+			     (unsigned long)i);
+		}
+	}
+	if (munmap(p)) {
+		err(1, "munmap");
+	}
+
+	lseek(fd, 0, SEEK_SET);
+	for (i = 0; i < size; i += 1000) {
+		lseek(fd, i, SEEK_SET);
+		if (read(fd, buf, 1) != 1) {
+			err(1, "read");
+		}
+		if (buf[0] != (unsigned char)~pattern(i)) {
+			errx(1, "File: wrong data at offset %lu",
+			     (unsigned long)i);
+		}
+	}
+}
+
+static
+void
+checkbyte(const char *what, size_t pos, unsigned char got, unsigned char want)
+{
+	if (got != want) {
+		errx(1, "%s: wrong data at offset %lu: 0x%x, expected 0x%x",
+		     what, (unsigned long)pos, got, want);
+	}
+}
+
+static
+void
+coherencetest(int fd, size_t size)
+{
+	unsigned char *p;
+	unsigned char c;
+	size_t i;
+
+	/* Cache every page, then write() behind the mapping's back */
+	p = mmap(size, PROT_READ|PROT_WRITE, fd, 0);
+	if (p == (void *)-1) {
+		err(1, "mmap");
+	}
+	for (i = 0; i < size; i += 1000) {
+		checkbyte("Mapping before write", i, p[i],
+			  (unsigned char)~pattern(i));
+	}
+	for (i = 0; i < size; i += 1000) {
+		c = pattern(i);
+		lseek(fd, i, SEEK_SET);
+		if (write(fd, &c, 1) != 1) {
+			err(1, "write");
+		}
+	}
+	for (i = 0; i < size; i += 1000) {
+		checkbyte("Mapping after write", i, p[i], pattern(i));
+	}
+
+	/* Store through the mapping and read() it straight back */
+	for (i = 500; i < size; i += 1000) {
+		p[i] = ~pattern(i);
+	}
+	for (i = 500; i < size; i += 1000) {
+		lseek(fd, i, SEEK_SET);
+		if (read(fd, &c, 1) != 1) {
+			err(1, "read");
+		}
+		checkbyte("File after store", i, c, (unsigned char)~pattern(i));
+	}
+	if (munmap(p)) {
+		err(1, "munmap");
+	}
+
+	/* A new mapping sees the write()s too */
+	p = mmap(size, PROT_READ, fd, 0);
+	if (p == (void *)-1) {
+		err(1, "mmap");
+	}
+	for (i = 0; i < size; i += 1000) {
+		checkbyte("New mapping", i, p[i], pattern(i));
+	}
+	if (munmap(p)) {
+		err(1, "munmap");
+	}
+
+	/* Cut the file in half and grow it back: the rest reads as 0 */
+	if (ftruncate(fd, size / 2) || ftruncate(fd, size)) {
+		err(1, "ftruncate");
+	}
+	p = mmap(size, PROT_READ, fd, 0);
+	if (p == (void *)-1) {
+		err(1, "mmap");
+	}
+	for (i = 0; i < size; i += 1000) {
+		checkbyte("Mapping after truncate", i, p[i],
+			  i < size / 2 ? pattern(i) : 0);
+	}
+	if (munmap(p)) {
+		err(1, "munmap");
+	}
+}
+
+/*
+ * After coherencetest the first half of the file is pattern() and the
+ * rest is 0.
+ */
+static
+void
+shorttest(int fd, size_t size)
+{
+	unsigned char *p, *q;
+	unsigned char want;
+	size_t i;
+
+	/* Dirty the first page through a 100-byte mapping */
+	p = mmap(100, PROT_READ|PROT_WRITE, fd, 0);
+	if (p == (void *)-1) {
+		err(1, "mmap");
+	}
+	p[0] = ~pattern(0);
+
+	/* A full mapping of the same page sees the file past byte 100 */
+	q = mmap(size, PROT_READ, fd, 0);
+	if (q == (void *)-1) {
+		err(1, "mmap");
+	}
+	for (i = 0; i < BUFSIZE; i++) {
+		want = i == 0 ? ~pattern(0) : i < size / 2 ? pattern(i) : 0;
+		checkbyte("Full mapping after short one", i, q[i], want);
+	}
+	if (munmap(q) || munmap(p)) {
+		err(1, "munmap");
+	}
+
+	/* Writing the page back kept the rest of it */
+	lseek(fd, 0, SEEK_SET);
+	if (read(fd, buf, BUFSIZE) != BUFSIZE) {
+		err(1, "read");
+	}
+	for (i = 0; i < BUFSIZE; i++) {
+		want = i == 0 ? ~pattern(0) : i < size / 2 ? pattern(i) : 0;
+		checkbyte("File after short mapping", i, buf[i], want);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *name = "mmapscan.dat";
+	size_t size = 2048 * 1024;
+	unsigned rsum, msum, expect;
+	unsigned long rms = 0, mms = 0;
+	time_t secs;
+	unsigned long nsecs;
+	size_t i;
+	int fd, pass;
+
+	if (argc > 1) {
+		name = argv[1];
+	}
+	if (argc > 2) {
+		size = atoi(argv[2]) * 1024;
+	}
+	size = (size + BUFSIZE - 1) / BUFSIZE * BUFSIZE;
+	if (size == 0) {
+		errx(1, "Usage: mmapscan [filename [kilobytes]]");
+	}
+
+	printf("Writing %lu KiB to %s...\n", (unsigned long)size / 1024, name);
+	makefile(name, size);
+	expect = 0;
+	for (i = 0; i < size; i++) {
+		expect += pattern(i);
+	}
+
+	fd = open(name, O_RDWR);
+	if (fd < 0) {
+		err(1, "%s: open", name);
+	}
+
+	for (pass = 0; pass < 2; pass++) {
+		now(&secs, &nsecs);
+		rsum = readscan(fd, size);
+		rms = msecs_since(secs, nsecs);
+
+		now(&secs, &nsecs);
+		msum = mmapscan(fd, size);
+		mms = msecs_since(secs, nsecs);
+
+		if (rsum != expect || msum != expect) {
+			errx(1, "Checksum mismatch: read %u, mmap %u, "
+			     "expected %u", rsum, msum, expect);
+		}
+	}
+	printf("read(): %lu ms\n", rms);
+	printf("mmap:   %lu ms\n", mms);
+
+	sharetest(fd, size);
+	coherencetest(fd, size);
+	shorttest(fd, size);
+	close(fd);
+	remove(name);
+
+	printf("Passed mmapscan.\n");
+	return 0;
+}
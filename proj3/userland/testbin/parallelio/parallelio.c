@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * parallelio - time file I/O from several processes at once.
+ *
+ * Usage: parallelio [nprocs [kilobytes]]
+ *
+ * Each of NPROCS processes (default 4) writes its own file of the
+ * given size (default 256 KiB), reads it back and checks it. The same
+ * total amount of work is first done by a single process, one file
+ * after another, and the two times are printed. With per-file locking
+ * in the filesystem the parallel run should not be slower than the
+ * serial one.
+ *
+ * Finally all the processes read one shared file at the same time,
+ * which exercises concurrent access to a single vnode.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <test/timing.h>
+
+#define BUFSIZE   4096
+#define MAXPROCS  16
+
+static unsigned char buf[BUFSIZE];
+
+static
+unsigned char
+pattern(unsigned id, size_t pos)
+{
+	return (unsigned char)(pos * 7 + pos / 4096 + id * 31);
+}
+
+static
+void
+filename(char *name, size_t len, unsigned id)
+{
+	snprintf(name, len, "pio-%u.dat", id);
+}
+
+static
+void
+writefile(const char *name, unsigned id, size_t size)
+{
+	size_t pos, i;
+	ssize_t r;
+	int fd;
+
+	fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s: open", name);
+	}
+	for (pos = 0; pos < size; pos += BUFSIZE) {
+		for (i = 0; i < BUFSIZE; i++) {
+			buf[i] = pattern(id, pos + i);
+		}
+		r = write(fd, buf, BUFSIZE);
+		if (r < 0) {
+			err(1, "%s: write", name);
+		}
+		if (r != BUFSIZE) {
+			errx(1, "%s: short write", name);
+		}
+	}
+	close(fd);
+}
+
+static
+void
+checkfile(const char *name, unsigned id, size_t size)
+{
+	size_t pos, i;
+	ssize_t r;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s: open", name);
+	}
+	for (pos = 0; pos < size; pos += r) {
+		r = read(fd, buf, BUFSIZE);
+		if (r < 0) {
+			err(1, "%s: read", name);
+		}
+		if (r == 0) {
+			errx(1, "%s: Unexpected EOF", name);
+		}
+		for (i = 0; i < (size_t)r; i++) {
+			if (buf[i] != pattern(id, pos + i)) {
+				errx(1, "%s: wrong data at offset %lu", name,
+				     (unsigned long)(pos + i));
+			}
+		}
+	}
+	close(fd);
+}
+
+/*
+ * One process's share of the work: its own file, written, read back
+ * and removed.
+ */
+static
+void
+job(unsigned id, size_t size)
+{
+	char name[32];
+
+	filename(name, sizeof(name), id);
+	writefile(name, id, size);
+	checkfile(name, id, size);
+	remove(name);
+}
+
+/*
+ * Fork NPROCS children, each running job(i) (or, if SHARED is set,
+ * reading the shared file), and wait for all of them.
+ */
+static
+void
+runparallel(unsigned nprocs, size_t size, const char *shared)
+{
+	pid_t pids[MAXPROCS];
+	unsigned i;
+	int status, failed = 0;
+
+	for (i = 0; i < nprocs; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			if (shared != NULL) {
+				checkfile(shared, MAXPROCS, size);
+			}
+			else {
+				job(i, size);
+			}
+			_exit(0);
+		}
+	}
+	for (i = 0; i < nprocs; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			warnx("child %u failed", i);
+			failed = 1;
+		}
+	}
+	if (failed) {
+		errx(1, "FAILED");
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned nprocs = 4;
+	size_t size = 256 * 1024;
+	unsigned long sms, pms, rms;
+	time_t secs;
+	unsigned long nsecs;
+	unsigned i;
+	char shared[32];
+
+	if (argc > 1) {
+		nprocs = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		size = atoi(argv[2]) * 1024;
+	}
+	size = (size + BUFSIZE - 1) / BUFSIZE * BUFSIZE;
+	if (nprocs == 0 || nprocs > MAXPROCS || size == 0) {
+		errx(1, "Usage: parallelio [nprocs [kilobytes]] "
+		     "(at most %u processes)", MAXPROCS);
+	}
+
+	printf("%u files of %lu KiB, serial then parallel...\n",
+	       nprocs, (unsigned long)size / 1024);
+
+	now(&secs, &nsecs);
+	for (i = 0; i < nprocs; i++) {
+		job(i, size);
+	}
+	sms = msecs_since(secs, nsecs);
+
+	now(&secs, &nsecs);
+	runparallel(nprocs, size, NULL);
+	pms = msecs_since(secs, nsecs);
+
+	/* The shared file uses an id none of the jobs have */
+	filename(shared, sizeof(shared), MAXPROCS);
+	writefile(shared, MAXPROCS, size);
+	now(&secs, &nsecs);
+	runparallel(nprocs, size, shared);
+	rms = msecs_since(secs, nsecs);
+	remove(shared);
+
+	printf("serial:        %lu ms\n", sms);
+	printf("parallel:      %lu ms\n", pms);
+	printf("shared reads:  %lu ms\n", rms);
+
+	printf("Passed parallelio.\n");
+	return 0;
+}